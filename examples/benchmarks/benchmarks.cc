@@ -0,0 +1,328 @@
+#include "../../src/libbgp.h"
+#include "../../src/rib.h"
+#include "../../src/rib_image.h"
+#include "../../src/session_io.h"
+#include "../../src/batch.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace LibBGP;
+
+uint64_t now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+double ms(uint64_t from) {
+    return (now() - from) / 1e6;
+}
+
+// an UPDATE from peer_as for count /24s from base (host byte order).
+BGPUpdateMessage makeUpdate(uint32_t peer_as, uint32_t next_hop, uint32_t base, int count) {
+    BGPUpdateMessage update = BGPUpdateMessage(); // no trace, no error
+    update.setOrigin(0);
+    update.setAsPath({ peer_as }, true);
+    update.setNexthop(htonl(next_hop));
+    for (int i = 0; i < count; i++) update.addPrefix(htonl(base + (i << 8)), 24, false);
+    return update;
+}
+
+/* write, open and load of an image of 1M routes, a third of them with a
+ * second path, over 1000 attribute sets.
+ */
+void benchImage(const char *path) {
+    BGPRib rib;
+    std::vector<BGPRibAttributesRef> sets;
+    for (uint32_t k = 0; k < 1000; k++) {
+        BGPUpdateMessage update = makeUpdate(65000, 0x0a000001 + k, 0, 0);
+        update.setAsPath({ 65000, k % 50, 7 }, true);
+        update.setLocalPref(100 + k % 3);
+        auto *attrs = new BGPRibAttributes(update.path_attribute);
+        attrs->nexthop = rib.nextHop(attrs->next_hop);
+        sets.push_back(BGPRibAttributesRef(attrs));
+    }
+
+    for (uint32_t i = 0; i < 1000000; i++) {
+        BGPRoute route;
+        route.prefix = htonl(0x01000000 + (i << 8));
+        route.length = 24;
+        route.path_id = 0;
+        rib.insert(1, route, sets[i % 1000]);
+        if (i % 3 == 0) rib.insert(2, route, sets[(i * 7) % 1000]);
+    }
+    rib.commit();
+
+    uint64_t start = now();
+    bool written = BGPRibImage::write(rib.snapshot(), path);
+    printf("image: write %s, %.0f ms\n", written ? "ok" : "failed", ms(start));
+    if (!written) return;
+
+    BGPRibImage image;
+    start = now();
+    bool opened = image.open(path);
+    printf("image: open %s, %.3f ms, %zu routes\n", opened ? "ok" : "failed", ms(start), image.size());
+
+    BGPRib loaded;
+    start = now();
+    bool ok = opened && image.load(loaded);
+    printf("image: load %s, %.0f ms, %zu routes\n", ok ? "ok" : "failed", ms(start), loaded.size());
+
+    unlink(path);
+}
+
+/* memory and lookup time over 200k prefixes with 1 to 8 ADD-PATH paths each. */
+void benchAddPath() {
+    const int prefixes = 200000;
+
+    for (int paths = 1; paths <= 8; paths *= 2) {
+        BGPUpdateMessage update = makeUpdate(65000, 0x0a000001, 0, 0);
+        update.add_path = true;
+        for (int i = 0; i < prefixes; i++)
+            for (int p = 0; p < paths; p++) update.addPrefix(htonl(i << 8), 24, false, p + 1);
+
+        size_t before = mallinfo2().uordblks;
+        BGPRib rib;
+        rib.update(1, update);
+        rib.commit();
+        size_t used = mallinfo2().uordblks - before;
+
+        auto snapshot = rib.snapshot();
+        size_t found = 0;
+        uint64_t start = now();
+        for (int i = 0; i < prefixes; i++) {
+            BGPRoute route;
+            route.prefix = htonl(i << 8);
+            route.length = 24;
+            route.path_id = 0;
+            auto *entry = snapshot.lookup(route);
+            found += entry && entry->getBest();
+        }
+        double lookup = (now() - start) / (double) prefixes;
+
+        printf("add-path: %d paths/prefix, %.0f bytes/prefix, lookup %.0f ns (%zu found)\n",
+            paths, (double) used / prefixes, lookup, found);
+    }
+}
+
+/* peer down on 1M prefixes, then the background sweep between commits. */
+void benchPeerDown() {
+    const int prefixes = 1000000;
+    BGPRib rib;
+    BGPPeerAccounting accounting;
+    rib.setAccounting(1, &accounting);
+
+    for (int base = 0; base < prefixes; base += 1000) {
+        BGPUpdateMessage update = makeUpdate(65001, 0x0a000001, base << 8, 1000);
+        rib.update(1, update);
+    }
+    rib.commit();
+
+    uint64_t start = now();
+    rib.peerDown(1);
+    printf("peer-down: %lu prefixes, peerDown() %.3f ms, %lu left in accounting\n",
+        (unsigned long) prefixes, ms(start), (unsigned long) accounting.prefixes());
+
+    std::vector<BGPRoute> dirty;
+    size_t batches = 0, touched = 0;
+    start = now();
+    for (bool more = true; more; batches++) {
+        more = rib.sweep(65536) > 0;
+        rib.commit();
+        rib.takeDirty(dirty);
+        touched += dirty.size();
+    }
+    printf("peer-down: sweep %.0f ms in %zu batches, %zu prefixes queued, %zu left\n", ms(start), batches, touched, rib.size());
+}
+
+/* 500k prefixes on one next-hop with a backup on another, then the first
+ * next-hop goes down.
+ */
+void benchNextHop() {
+    const int prefixes = 500000;
+    BGPRib rib;
+
+    for (int base = 0; base < prefixes; base += 1000) {
+        BGPUpdateMessage primary = makeUpdate(65001, 0x0a000001, base << 8, 1000);
+        BGPUpdateMessage backup = makeUpdate(65002, 0x0a000002, base << 8, 1000);
+        backup.setLocalPref(50);
+        rib.update(1, primary);
+        rib.update(2, backup);
+    }
+    rib.commit();
+
+    BGPRoute probe;
+    probe.prefix = htonl(5 << 8);
+    probe.length = 24;
+    probe.path_id = 0;
+
+    uint64_t start = now();
+    rib.setNextHop(htonl(0x0a000001), false, 0);
+    uint32_t peer;
+    {
+        auto snapshot = rib.snapshot();
+        peer = snapshot.lookup(probe)->getBest()->peer;
+    }
+    printf("next-hop: failover seen by getBest() after %.3f ms (best from peer %u)\n", ms(start), peer);
+
+    start = now();
+    rib.commit();
+    std::vector<BGPRoute> dirty;
+    rib.takeDirty(dirty);
+    printf("next-hop: best-path re-run at commit %.0f ms, %zu prefixes moved\n", ms(start), dirty.size());
+}
+
+class Discard : public BGPIoHandler {
+public:
+    void message(int, const uint8_t *, size_t) {}
+    void closed(int, int) {}
+};
+
+/* parse + RIB + send loop, with every UPDATE sampled, one in 100, or none.
+ * a sampled UPDATE times best-path around each of its prefixes, so what
+ * tracing every UPDATE costs grows with prefixes per UPDATE.
+ */
+double traceLoop(uint32_t every, int updates, int prefixes, bool show) {
+    BGPTracer tracer(every);
+    BGPRib rib;
+    BGPParseContext ctx;
+    ctx.trace = tracer.peer(1);
+
+    Discard handler;
+    BGPIoBackend *io = BGPIoBackend::create(BGPIoBackend::EPOLL, &handler);
+    int fds[2];
+    socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    int conn = io->add(fds[0]);
+
+    static uint8_t inbound[64][4096];
+    for (int i = 0; i < 64; i++) {
+        BGPPacket packet;
+        packet.type = 2;
+        packet.update = makeUpdate(65001, 0x0a000001, 0x0a000000 + i * prefixes * 256, prefixes);
+        packet.write(inbound[i]);
+    }
+
+    uint8_t outbound[4096];
+    BGPPacket packet;
+    packet.type = 2;
+    packet.update = makeUpdate(65000, 0x0a000001, 0x0b000000, 1);
+    int out_length = packet.write(outbound);
+
+    uint64_t start = now();
+    for (int k = 0; k < updates; k++) {
+        BGPPacket received(inbound[k % 64], &ctx);
+        rib.update(1, received.update);
+        if (k % 64 == 63) rib.commit();
+
+        // stands in for the export of the best path.
+        io->send(conn, outbound, out_length);
+        io->trace(conn, received.update.trace);
+        if (k % 16 == 15) {
+            io->poll(0);
+            char drain[65536];
+            while (read(fds[1], drain, sizeof(drain)) > 0);
+        }
+    }
+    io->poll(0);
+    double elapsed = ms(start);
+
+    if (show) {
+        const char *names[BGP_TRACE_STAGES] = { "parse", "rib", "best-path", "adj-rib-out", "socket", "total" };
+        for (int s = 0; s < BGP_TRACE_STAGES; s++) {
+            auto &h = ctx.trace->histogram(s);
+            printf("trace: %-11s n=%lu p50=%lu p99=%lu p999=%lu ns\n", names[s], (unsigned long) h.count(),
+                (unsigned long) h.percentile(0.5), (unsigned long) h.percentile(0.99), (unsigned long) h.percentile(0.999));
+        }
+    }
+
+    delete io;
+    close(fds[1]);
+    return elapsed;
+}
+
+void benchTrace(int prefixes) {
+    const int updates = 200000, rounds = 3;
+    double off = 0, sampled = 0, every = 0;
+
+    traceLoop(0, updates, prefixes, false); // warm up
+    for (int r = 0; r < rounds; r++) {
+        off += traceLoop(0, updates, prefixes, false);
+        sampled += traceLoop(100, updates, prefixes, false);
+        every += traceLoop(1, updates, prefixes, r == rounds - 1);
+    }
+
+    printf("trace: %d prefixes/UPDATE, off %.0f ms, 1 in 100 %.0f ms (%+.1f%%), every UPDATE %.0f ms (%+.1f%%)\n", prefixes,
+        off / rounds, sampled / rounds, (sampled - off) / off * 100, every / rounds, (every - off) / off * 100);
+}
+
+/* 400k UPDATEs of 1 to 8 prefixes, some with a withdrawal, decoded one
+ * BGPPacket per message and then with the batch decoder.
+ */
+void benchBatch(int threads) {
+    std::vector<uint8_t> stream;
+    uint8_t buffer[4096];
+
+    for (int i = 0; i < 400000; i++) {
+        BGPPacket packet;
+        packet.type = 2;
+        auto &update = packet.update;
+        update.setNexthop(htonl(0x0a000001 + i % 7));
+        update.setOrigin(0);
+        update.setAsPath({ 65001, (uint32_t) (64512 + i % 50), 4200000000u + i % 13 }, true);
+        update.setLocalPref(100);
+        for (int k = 0; k <= i % 8; k++) update.addPrefix(htonl((uint32_t) (i * 8 + k) << 8), 24, false);
+        if (i % 5 == 0) update.addPrefix(htonl(0x0b000000 + (i << 8)), 24, true);
+
+        int length = packet.write(buffer);
+        stream.insert(stream.end(), buffer, buffer + length);
+    }
+
+    uint64_t start = now();
+    size_t rows = 0;
+    for (uint8_t *at = stream.data(), *end = at + stream.size(); at < end;) {
+        uint16_t length;
+        memcpy(&length, at + 16, 2);
+        BGPPacket packet(at);
+        rows += packet.update.nlri.size() + packet.update.withdrawn_routes.size();
+        at += ntohs(length);
+    }
+    printf("batch: %.1f MB, BGPPacket per message %.0f ms, %zu rows\n", stream.size() / 1e6, ms(start), rows);
+
+    std::vector<BGPBatchInput> inputs(1);
+    inputs[0].buffer = stream.data();
+    inputs[0].length = stream.size();
+    inputs[0].timestamp = 0;
+    inputs[0].peer = 1;
+    inputs[0].as4 = true;
+    inputs[0].add_path = false;
+
+    BGPBatchDecoder decoder(threads);
+    BGPRouteColumns columns;
+    start = now();
+    decoder.decode(inputs, columns);
+    printf("batch: decoder (%d threads, 0: one per core) %.0f ms, %zu rows, %zu attribute sets\n",
+        threads, ms(start), columns.size(), decoder.attributeSets());
+}
+
+int main(int argc, char **argv) {
+    const char *which = argc > 1 ? argv[1] : "all";
+    bool all = !strcmp(which, "all");
+
+    if (all || !strcmp(which, "image")) benchImage(argc > 2 ? argv[2] : "/tmp/libbgp-bench.img");
+    if (all || !strcmp(which, "add-path")) benchAddPath();
+    if (all || !strcmp(which, "peer-down")) benchPeerDown();
+    if (all || !strcmp(which, "next-hop")) benchNextHop();
+    if (all || !strcmp(which, "trace")) benchTrace(argc > 2 ? atoi(argv[2]) : 1);
+    if (all || !strcmp(which, "batch")) benchBatch(argc > 2 ? atoi(argv[2]) : 1);
+
+    return 0;
+}
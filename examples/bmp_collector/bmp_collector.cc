@@ -0,0 +1,104 @@
+#include "../../src/libbgp.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+static const char *type_names[] = {
+    "Route Monitoring", "Statistics Report", "Peer Down", "Peer Up",
+    "Initiation", "Termination", "Route Mirroring"
+};
+
+// reads exactly length bytes, false on close.
+bool read_full(int fd, uint8_t *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t got = read(fd, buffer, length);
+        if (got <= 0) return false;
+        buffer += got;
+        length -= got;
+    }
+    return true;
+}
+
+int main (int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "/tmp/bmp.sock";
+    int delay = argc > 2 ? atoi(argv[2]) : 0; // ms per message, to play a slow collector
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    int fd_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(path);
+    if (bind(fd_sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd_sock, 1) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    printf("Waiting for an exporter on %s.\n", path);
+    int fd_conn = accept(fd_sock, NULL, NULL);
+
+    uint8_t *buffer = (uint8_t *) malloc(65536 + 6);
+    unsigned long counts[7] = { 0 }, routes = 0, withdrawn = 0;
+
+    // common header: version (1), length (4), type (1).
+    while (read_full(fd_conn, buffer, 6)) {
+        uint32_t length;
+        memcpy(&length, buffer + 1, 4);
+        length = ntohl(length);
+        uint8_t type = buffer[5];
+
+        if (buffer[0] != 3 || length < 6 || length > 65536 + 6 || !read_full(fd_conn, buffer + 6, length - 6)) {
+            printf("Bad message (version %d, length %u), closing.\n", buffer[0], length);
+            break;
+        }
+
+        if (type > 6) {
+            printf("Unknown message type %d, %u bytes.\n", type, length);
+            continue;
+        }
+        counts[type]++;
+        printf("%s, %u bytes", type_names[type], length);
+
+        // per-peer header: type, flags, distinguisher, address, asn, bgp id, timestamp.
+        if (type <= 3 && length >= 6 + 42) {
+            uint8_t *peer = buffer + 6;
+            uint32_t asn, address;
+            memcpy(&address, peer + 22, 4);
+            memcpy(&asn, peer + 26, 4);
+            char ip[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &address, ip, sizeof(ip));
+            printf(", peer AS%u %s", ntohl(asn), ip);
+
+            if (type == 0 && length >= 6 + 42 + 19) {
+                LibBGP::BGPParseContext context;
+                context.as4 = !(peer[1] & 0x20);
+                LibBGP::BGPPacket bgp_pkt (peer + 42, &context);
+                if (bgp_pkt.type == 2) {
+                    printf(", nlri: %zu, withdrawn: %zu", bgp_pkt.update.nlri.size(), bgp_pkt.update.withdrawn_routes.size());
+                    routes += bgp_pkt.update.nlri.size();
+                    withdrawn += bgp_pkt.update.withdrawn_routes.size();
+                }
+            }
+        }
+        printf(".\n");
+
+        if (type == 5) break;
+        if (delay) usleep(delay * 1000);
+    }
+
+    printf("Exporter gone.\n");
+    for (int i = 0; i < 7; i++)
+        if (counts[i]) printf("%s: %lu\n", type_names[i], counts[i]);
+    printf("Routes: %lu, withdrawn: %lu\n", routes, withdrawn);
+
+    close(fd_conn);
+    close(fd_sock);
+    unlink(path);
+    free(buffer);
+    return 0;
+}
@@ -0,0 +1,68 @@
+#include "../../src/libbgp.h"
+#include "../../src/bmp.h"
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* feeds bmp_collector: an Initiation, then Route Monitoring messages as
+ * fast as the exporter takes them, through a small queue so a slow
+ * collector makes it drop and resync, then a Termination.
+ */
+int main (int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : "/tmp/bmp.sock";
+    int messages = argc > 2 ? atoi(argv[2]) : 5000;
+
+    LibBGP::BGPBmpExporter exporter(64 * 1024);
+    if (!exporter.connectUnix(path)) {
+        printf("Cannot connect to %s.\n", path);
+        return 1;
+    }
+
+    LibBGP::BGPBmpPeer peer;
+    peer.asn = 65001;
+    inet_pton(AF_INET, "172.31.0.1", &peer.address);
+    peer.bgp_id = peer.address;
+
+    // one UPDATE of 100 /24s from 10.0.0.0.
+    uint8_t *update = (uint8_t *) malloc(4096);
+    LibBGP::BGPPacket bgp_pkt;
+    bgp_pkt.type = 2;
+    bgp_pkt.update.setOrigin(0);
+    bgp_pkt.update.setAsPath({ peer.asn }, true);
+    bgp_pkt.update.setNexthop(peer.address);
+    for (int i = 0; i < 100; i++) bgp_pkt.update.addPrefix(htonl(0x0a000000 + (i << 8)), 24, false);
+    int length = bgp_pkt.write(update);
+
+    int resyncs = 0;
+    exporter.setResync([&](LibBGP::BGPBmpExporter &e, bool restart) {
+        if (restart) {
+            resyncs++;
+            e.initiation("libbgp", "bmp_feed");
+        }
+        // the table here is the one UPDATE.
+        e.routeMonitoring(peer, update, length);
+        return false;
+    });
+
+    exporter.initiation("libbgp", "bmp_feed");
+    int accepted = 0;
+    for (int i = 0; i < messages; i++) accepted += exporter.routeMonitoring(peer, update, length);
+
+    while (exporter.pending()) {
+        exporter.flush();
+        usleep(1000);
+    }
+
+    exporter.termination(0);
+    while (exporter.pending()) {
+        exporter.flush();
+        usleep(1000);
+    }
+
+    printf("%d of %d Route Monitoring taken, %lu dropped, %d resyncs, %lu sent.\n", accepted, messages,
+        (unsigned long) exporter.drops(), resyncs, (unsigned long) exporter.sent());
+
+    free(update);
+    return 0;
+}
@@ -0,0 +1,124 @@
+#include "../../src/libbgp.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+/* runs truncated and malformed UPDATEs through LibBGP::Parse and checks what
+ * the parser made of them (RFC 7606): the action, subcode and attribute, and
+ * where the nlri went. exits non-zero if any of them is off.
+ */
+
+typedef std::vector<uint8_t> Bytes;
+
+static Bytes cat(std::initializer_list<Bytes> parts) {
+    Bytes out;
+    for (auto &part : parts) out.insert(out.end(), part.begin(), part.end());
+    return out;
+}
+
+// attributes length, then the attributes.
+static Bytes attrs(const Bytes &list) {
+    return cat({ { (uint8_t) (list.size() >> 8), (uint8_t) list.size() }, list });
+}
+
+static const Bytes no_withdrawn = { 0x00, 0x00 };
+static const Bytes origin = { 0x40, 0x01, 0x01, 0x00 }; // IGP
+static const Bytes as_path = { 0x40, 0x02, 0x06, 0x02, 0x01, 0x00, 0x00, 0xfd, 0xe8 }; // 65000
+static const Bytes next_hop = { 0x40, 0x03, 0x04, 0xac, 0x1f, 0x00, 0x01 }; // 172.31.0.1
+static const Bytes med = { 0x80, 0x04, 0x04, 0x00, 0x00, 0x00, 0x64 }; // 100
+static const Bytes nlri = { 0x18, 0x0a, 0x00, 0x00 }; // 10.0.0.0/24
+
+static int failed = 0;
+
+static void parse(const Bytes &body, uint8_t type, uint16_t length, LibBGP::BGPPacket *parsed) {
+    uint8_t buffer[4096];
+    memset(buffer, 0xff, 16);
+    buffer[16] = length >> 8;
+    buffer[17] = length & 0xff;
+    buffer[18] = type;
+    memcpy(buffer + 19, body.data(), body.size());
+    LibBGP::Parse(buffer, parsed);
+}
+
+static void check(const char *name, const Bytes &body, uint8_t action, uint8_t subcode, uint8_t attrib,
+    size_t nlri_count, size_t withdrawn_count, int length = -1) {
+    LibBGP::BGPPacket parsed;
+    parse(body, 2, length < 0 ? body.size() + 19 : length, &parsed);
+    auto &msg = parsed.update;
+
+    bool ok = msg.error_action == action && msg.error_subcode == subcode && msg.error_attribute == attrib;
+    if (action < LibBGP::BGP_UPDATE_SESSION_RESET)
+        ok = ok && msg.nlri.size() == nlri_count && msg.withdrawn_routes.size() == withdrawn_count;
+
+    printf("%-40s action: %d, subcode: %d, attribute: %d, nlri: %lu, withdrawn: %lu. %s\n", name,
+        msg.error_action, msg.error_subcode, msg.error_attribute, (unsigned long) msg.nlri.size(),
+        (unsigned long) msg.withdrawn_routes.size(), ok ? "ok" : "FAILED");
+    if (!ok) failed++;
+}
+
+int main (void) {
+    using namespace LibBGP;
+
+    check("well-formed", cat({ no_withdrawn, attrs(cat({ origin, as_path, next_hop })), nlri }),
+        BGP_UPDATE_OK, 0, 0, 1, 0);
+
+    // nothing after the header but the withdrawn routes length.
+    check("shorter than an UPDATE", no_withdrawn, BGP_UPDATE_SESSION_RESET, 1, 0, 0, 0);
+
+    check("withdrawn routes overrun", { 0x00, 0x10, 0x00, 0x00 }, BGP_UPDATE_SESSION_RESET, 1, 0, 0, 0);
+
+    check("withdrawn prefix of 33 bits", cat({ { 0x00, 0x02, 0x21, 0x0a }, attrs({}) }),
+        BGP_UPDATE_SESSION_RESET, 10, 0, 0, 0);
+
+    check("attributes overrun", cat({ no_withdrawn, { 0x00, 0x40 } }), BGP_UPDATE_SESSION_RESET, 1, 0, 0, 0);
+
+    check("truncated attribute header", cat({ no_withdrawn, attrs({ 0x40, 0x01 }), nlri }),
+        BGP_UPDATE_TREAT_AS_WITHDRAW, 5, 0, 0, 1);
+
+    check("attribute value overrun", cat({ no_withdrawn, attrs({ 0x40, 0x01, 0x05, 0x00 }), nlri }),
+        BGP_UPDATE_TREAT_AS_WITHDRAW, 5, 1, 0, 1);
+
+    check("ORIGIN of 5", cat({ no_withdrawn, attrs(cat({ { 0x40, 0x01, 0x01, 0x05 }, as_path, next_hop })), nlri }),
+        BGP_UPDATE_TREAT_AS_WITHDRAW, 6, 1, 0, 1);
+
+    check("ORIGIN flagged optional", cat({ no_withdrawn, attrs(cat({ { 0xc0, 0x01, 0x01, 0x00 }, as_path, next_hop })), nlri }),
+        BGP_UPDATE_TREAT_AS_WITHDRAW, 4, 1, 0, 1);
+
+    check("AS_PATH segment overrun", cat({ no_withdrawn, attrs(cat({ origin, { 0x40, 0x02, 0x03, 0x02, 0x05, 0x00 }, next_hop })), nlri }),
+        BGP_UPDATE_TREAT_AS_WITHDRAW, 11, 2, 0, 1);
+
+    check("NEXT_HOP missing", cat({ no_withdrawn, attrs(cat({ origin, as_path })), nlri }),
+        BGP_UPDATE_TREAT_AS_WITHDRAW, 3, 3, 0, 1);
+
+    check("MED twice", cat({ no_withdrawn, attrs(cat({ origin, as_path, next_hop, med, med })), nlri }),
+        BGP_UPDATE_ATTRIBUTE_DISCARD, 1, 4, 1, 0);
+
+    // without a context the session is taken to have 4-byte ASNs.
+    check("AGGREGATOR of 8 bytes", cat({ no_withdrawn, attrs(cat({ origin, as_path, next_hop, { 0xc0, 0x07, 0x08, 0, 0, 0xfd, 0xe8, 0xac, 0x1f, 0, 1 } })), nlri }),
+        BGP_UPDATE_OK, 0, 0, 1, 0);
+
+    check("AGGREGATOR of 6 bytes", cat({ no_withdrawn, attrs(cat({ origin, as_path, next_hop, { 0xc0, 0x07, 0x06, 0xfd, 0xe8, 0xac, 0x1f, 0, 1 } })), nlri }),
+        BGP_UPDATE_ATTRIBUTE_DISCARD, 5, 7, 1, 0);
+
+    check("COMMUNITIES of 5 bytes", cat({ no_withdrawn, attrs(cat({ origin, as_path, next_hop, { 0xc0, 0x08, 0x05, 0, 0, 0, 0, 0 } })), nlri }),
+        BGP_UPDATE_TREAT_AS_WITHDRAW, 5, 8, 0, 1);
+
+    check("unrecognized well-known", cat({ no_withdrawn, attrs(cat({ origin, as_path, next_hop, { 0x40, 0x63, 0x00 } })), nlri }),
+        BGP_UPDATE_SESSION_RESET, 2, 0x63, 0, 0);
+
+    check("unrecognized optional non-transitive", cat({ no_withdrawn, attrs(cat({ origin, as_path, next_hop, { 0x80, 0x63, 0x01, 0x00 } })), nlri }),
+        BGP_UPDATE_OK, 0, 0, 1, 0);
+
+    check("nlri prefix of 33 bits", cat({ no_withdrawn, attrs(cat({ origin, as_path, next_hop })), { 0x21, 0x0a, 0, 0, 0, 0 } }),
+        BGP_UPDATE_SESSION_RESET, 10, 0, 0, 0);
+
+    // a NOTIFICATION without its subcode is left alone.
+    LibBGP::BGPPacket notification;
+    parse({ 0x03 }, 3, 20, &notification);
+    bool ok = notification.notification.error_code == 0 && notification.notification.data.empty();
+    printf("%-40s error_code: %d. %s\n", "truncated NOTIFICATION", notification.notification.error_code, ok ? "ok" : "FAILED");
+    if (!ok) failed++;
+
+    if (failed) printf("%d failed.\n", failed);
+    return failed ? 1 : 0;
+}
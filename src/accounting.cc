@@ -0,0 +1,135 @@
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <time.h>
+#include "accounting.h"
+#include "libbgp.h"
+
+namespace LibBGP {
+
+static const std::memory_order relaxed = std::memory_order_relaxed;
+
+static int64_t monotonicSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + 1; // never 0
+}
+
+BGPPeerAccounting::BGPPeerAccounting() {
+    this->limit = 0;
+    this->warning = 0;
+    this->restart = 0;
+    this->prefix_count = 0;
+    this->route_bytes = 0;
+    this->attribute_bytes = 0;
+    this->output_bytes = 0;
+    this->warning_count = 0;
+    this->warned = false;
+    this->exceeded_at = 0;
+}
+
+void BGPPeerAccounting::setMaxPrefix(uint32_t limit, uint8_t warning, uint32_t restart) {
+    this->limit.store(limit, relaxed);
+    this->warning.store(warning, relaxed);
+    this->restart.store(restart, relaxed);
+}
+
+uint64_t BGPPeerAccounting::headroom() const {
+    uint64_t limit = this->limit.load(relaxed), count = this->prefix_count.load(relaxed);
+    if (!limit) return UINT64_MAX;
+    return count < limit ? limit - count : 0;
+}
+
+/* once per crossing: the flag is cleared when the count falls back under. */
+void BGPPeerAccounting::checkWarning(uint64_t accepted) {
+    uint64_t limit = this->limit.load(relaxed), warning = this->warning.load(relaxed);
+    if (!limit || !warning) return;
+
+    bool over = (this->prefix_count.load(relaxed) + accepted) * 100 >= limit * warning;
+    if (over && !this->warned.exchange(true, relaxed)) this->warning_count.fetch_add(1, relaxed);
+    if (!over && this->warned.load(relaxed)) this->warned.store(false, relaxed);
+}
+
+void BGPPeerAccounting::exceed() {
+    int64_t none = 0;
+    this->exceeded_at.compare_exchange_strong(none, monotonicSeconds(), relaxed);
+}
+
+BGPNotificationMessage BGPPeerAccounting::notification() const {
+    BGPNotificationMessage msg(6, 1); // Cease, Maximum Number of Prefixes Reached
+    uint32_t limit = htonl(this->limit.load(relaxed));
+    const uint8_t *bound = (const uint8_t *) &limit;
+    msg.data = { 0, 1, 1, bound[0], bound[1], bound[2], bound[3] }; // AFI 1, SAFI 1, upper bound
+    return msg;
+}
+
+bool BGPPeerAccounting::restartDue() const {
+    int64_t at = this->exceeded_at.load(relaxed);
+    uint32_t restart = this->restart.load(relaxed);
+    return at && restart && monotonicSeconds() >= at + restart;
+}
+
+void BGPPeerAccounting::reset() {
+    this->exceeded_at.store(0, relaxed);
+    this->warned.store(false, relaxed);
+}
+
+void BGPPeerAccounting::addRoute(size_t bytes) {
+    this->prefix_count.fetch_add(1, relaxed);
+    this->route_bytes.fetch_add(bytes, relaxed);
+}
+
+void BGPPeerAccounting::removeRoute(size_t bytes) {
+    this->prefix_count.fetch_sub(1, relaxed);
+    this->route_bytes.fetch_sub(bytes, relaxed);
+}
+
+void BGPPeerAccounting::removeRoutes(uint64_t count, size_t bytes) {
+    this->prefix_count.fetch_sub(count, relaxed);
+    this->route_bytes.fetch_sub(bytes, relaxed);
+}
+
+void BGPPeerAccounting::addAttributes(size_t bytes) {
+    this->attribute_bytes.fetch_add(bytes, relaxed);
+}
+
+void BGPPeerAccounting::removeAttributes(size_t bytes) {
+    this->attribute_bytes.fetch_sub(bytes, relaxed);
+}
+
+void BGPPeerAccounting::addOutput(size_t bytes) {
+    this->output_bytes.fetch_add(bytes, relaxed);
+}
+
+void BGPPeerAccounting::removeOutput(size_t bytes) {
+    this->output_bytes.fetch_sub(bytes, relaxed);
+}
+
+uint64_t BGPPeerAccounting::prefixes() const {
+    return this->prefix_count.load(relaxed);
+}
+
+uint64_t BGPPeerAccounting::routeBytes() const {
+    return this->route_bytes.load(relaxed);
+}
+
+uint64_t BGPPeerAccounting::attributeBytes() const {
+    return this->attribute_bytes.load(relaxed);
+}
+
+uint64_t BGPPeerAccounting::outputBytes() const {
+    return this->output_bytes.load(relaxed);
+}
+
+uint64_t BGPPeerAccounting::totalBytes() const {
+    return this->routeBytes() + this->attributeBytes() + this->outputBytes();
+}
+
+uint64_t BGPPeerAccounting::warnings() const {
+    return this->warning_count.load(relaxed);
+}
+
+bool BGPPeerAccounting::exceeded() const {
+    return this->exceeded_at.load(relaxed) != 0;
+}
+
+}
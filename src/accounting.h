@@ -0,0 +1,79 @@
+#ifndef LIBBGP_ACCOUNTING_H
+#define LIBBGP_ACCOUNTING_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+
+namespace LibBGP {
+
+struct BGPNotificationMessage;
+
+/* per-peer memory and prefix counts, each kept by whoever holds the memory:
+ * BGPRib for Adj-RIB-In routes and the attribute sets they reference,
+ * BGPIoBackend for output not yet written. plain relaxed atomics, so they
+ * can be read from any thread at any time without touching the table.
+ * must outlive the RIB paths and connections it is attached to.
+ */
+class BGPPeerAccounting {
+public:
+    BGPPeerAccounting();
+
+    /* max-prefix. limit 0 is no limit, warning is in percent of the limit,
+     * restart is how many seconds to keep the session down once the limit
+     * was hit (0: until reset() is called).
+     */
+    void setMaxPrefix(uint32_t limit, uint8_t warning, uint32_t restart);
+
+    // prefixes the peer may still add, from the parser before reading nlri.
+    uint64_t headroom() const;
+
+    // from the parser after counting nlri: accepted on top of prefixes().
+    void checkWarning(uint64_t accepted);
+    void exceed();
+
+    // Cease, Maximum Number of Prefixes Reached (RFC 4486), with AFI/SAFI.
+    BGPNotificationMessage notification() const;
+
+    // the limit was hit and restart seconds passed since.
+    bool restartDue() const;
+    void reset();
+
+    void addRoute(size_t bytes);
+    void removeRoute(size_t bytes);
+    void removeRoutes(uint64_t count, size_t bytes); // bytes in all
+    void addAttributes(size_t bytes);
+    void removeAttributes(size_t bytes);
+    void addOutput(size_t bytes);
+    void removeOutput(size_t bytes);
+
+    uint64_t prefixes() const; // in the Adj-RIB-In
+    uint64_t routeBytes() const;
+    uint64_t attributeBytes() const;
+    uint64_t outputBytes() const;
+    uint64_t totalBytes() const;
+
+    uint64_t warnings() const; // times the warning threshold was crossed
+    bool exceeded() const;
+
+private:
+    BGPPeerAccounting(const BGPPeerAccounting &) = delete;
+    BGPPeerAccounting& operator= (const BGPPeerAccounting &) = delete;
+
+    std::atomic<uint32_t> limit;
+    std::atomic<uint8_t> warning;
+    std::atomic<uint32_t> restart;
+
+    std::atomic<uint64_t> prefix_count;
+    std::atomic<uint64_t> route_bytes;
+    std::atomic<uint64_t> attribute_bytes;
+    std::atomic<uint64_t> output_bytes;
+
+    std::atomic<uint64_t> warning_count;
+    std::atomic<bool> warned;
+    std::atomic<int64_t> exceeded_at; // monotonic seconds, 0: not exceeded
+};
+
+}
+
+#endif // LIBBGP_ACCOUNTING_H
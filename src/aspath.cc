@@ -0,0 +1,402 @@
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include "aspath.h"
+
+namespace LibBGP {
+
+struct BGPAsPath::Node {
+    std::atomic<uint32_t> refs;
+    uint32_t asn;
+    uint8_t segment; // type, and SEGMENT_END on the last AS of a segment
+    uint32_t size; // nodes from this one to the origin
+    uint32_t length; // same, counted as in BGPAsPath::length()
+    uint32_t origin;
+    uint64_t serial; // never reused, see BGPAsPath::id()
+    Node *next; // toward the origin, referenced by this node
+};
+
+namespace {
+
+typedef BGPAsPath::Node Node;
+
+enum { SEGMENT_END = 0x80, SEGMENT_TYPE = 0x7f };
+
+struct Key {
+    uint32_t asn;
+    uint8_t segment;
+    const Node *next;
+
+    bool operator== (const Key &other) const {
+        return this->asn == other.asn && this->segment == other.segment && this->next == other.next;
+    }
+};
+
+struct KeyHash {
+    size_t operator() (const Key &key) const {
+        uint64_t h = ((uint64_t) (uintptr_t) key.next * 0x9e3779b97f4a7c15ULL) ^ key.asn ^ ((uint64_t) key.segment << 32);
+        return h ^ (h >> 29);
+    }
+};
+
+struct Hop {
+    uint32_t asn;
+    uint8_t segment;
+};
+
+struct Memo {
+    Node *as_path;
+    Node *as4_path;
+    Node *result;
+};
+
+struct Store {
+    std::mutex lock;
+    std::unordered_map<Key, Node*, KeyHash> nodes;
+    Memo memo[BGPAsPath::MEMO_SIZE];
+    std::vector<Hop> scratch; // for decode(), used with the lock held
+    uint64_t serial;
+
+    Store() {
+        memset(this->memo, 0, sizeof(this->memo));
+        this->serial = 0;
+    }
+};
+
+Store& store() {
+    static Store s;
+    return s;
+}
+
+void acquire(Node *node) {
+    if (node) node->refs.fetch_add(1);
+}
+
+/* with the store locked. dropping a node drops its reference on the rest of
+ * the path, which may go with it.
+ */
+void releaseLocked(Store &s, Node *node) {
+    while (node && node->refs.fetch_sub(1) == 1) {
+        Key key = { node->asn, node->segment, node->next };
+        s.nodes.erase(key);
+        Node *next = node->next;
+        delete node;
+        node = next;
+    }
+}
+
+/* as for community lists, the count only drops to zero with the store
+ * locked, so a concurrent intern finds a node either alive or not at all.
+ */
+void release(Node *node) {
+    if (!node) return;
+
+    uint32_t refs = node->refs.load();
+    while (refs > 1)
+        if (node->refs.compare_exchange_weak(refs, refs - 1)) return;
+
+    auto &s = store();
+    std::lock_guard<std::mutex> guard(s.lock);
+    releaseLocked(s, node);
+}
+
+/* node for asn followed by next, with a reference for the caller. the
+ * caller's reference on next is left alone.
+ */
+Node* consLocked(Store &s, uint32_t asn, uint8_t segment, Node *next) {
+    Key key = { asn, segment, next };
+    auto found = s.nodes.find(key);
+    if (found != s.nodes.end()) {
+        found->second->refs.fetch_add(1);
+        return found->second;
+    }
+
+    auto *node = new Node;
+    node->refs = 1;
+    node->asn = asn;
+    node->segment = segment;
+    node->next = next;
+    node->size = next ? next->size + 1 : 1;
+
+    uint8_t type = segment & SEGMENT_TYPE;
+    bool counts = type == BGPAsPath::AS_SEQUENCE || (type == BGPAsPath::AS_SET && (segment & SEGMENT_END));
+    node->length = (next ? next->length : 0) + counts;
+    node->origin = next ? next->origin : asn;
+    node->serial = ++s.serial;
+    acquire(next);
+    s.nodes[key] = node;
+    return node;
+}
+
+/* interns read(count - 1), a Hop, first and works back to read(0). */
+template <typename Read> Node* buildLocked(Store &s, size_t count, Node *tail, Read read) {
+    Node *node = tail;
+    acquire(node);
+
+    for (size_t i = count; i > 0; i--) {
+        Hop hop = read(i - 1);
+        Node *head = consLocked(s, hop.asn, hop.segment, node);
+        releaseLocked(s, node);
+        node = head;
+    }
+
+    return node;
+}
+
+}
+
+uint32_t BGPAsPath::Iterator::operator* () const {
+    return this->node->asn;
+}
+
+uint8_t BGPAsPath::Iterator::segment() const {
+    return this->node->segment & SEGMENT_TYPE;
+}
+
+BGPAsPath::Iterator& BGPAsPath::Iterator::operator++ () {
+    this->node = this->node->next;
+    return *this;
+}
+
+BGPAsPath::BGPAsPath() {
+    this->node = NULL;
+}
+
+BGPAsPath::BGPAsPath(const BGPAsPath &other) {
+    this->node = other.node;
+    acquire(this->node);
+}
+
+BGPAsPath& BGPAsPath::operator= (const BGPAsPath &other) {
+    if (this->node == other.node) return *this;
+    acquire(other.node);
+    release(this->node);
+    this->node = other.node;
+    return *this;
+}
+
+BGPAsPath::~BGPAsPath() {
+    release(this->node);
+}
+
+BGPAsPath BGPAsPath::intern(const uint32_t *asns, size_t count) {
+    BGPAsPath path;
+    if (!count) return path;
+
+    auto &s = store();
+    std::lock_guard<std::mutex> guard(s.lock);
+    path.node = buildLocked(s, count, NULL, [asns, count](size_t i) {
+        return Hop { asns[i], (uint8_t) (AS_SEQUENCE | (i == count - 1 ? SEGMENT_END : 0)) };
+    });
+    return path;
+}
+
+BGPAsPath BGPAsPath::intern(const std::vector<uint32_t> &asns) {
+    return intern(asns.data(), asns.size());
+}
+
+BGPAsPath BGPAsPath::decode(const uint8_t *data, size_t length, int width) {
+    BGPAsPath path;
+    if (!length) return path;
+
+    auto &s = store();
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    auto &hops = s.scratch;
+    hops.clear();
+    for (const uint8_t *end = data + length; end - data >= 2;) {
+        uint8_t type = data[0], count = data[1];
+        data += 2;
+        for (uint8_t i = 0; i < count; i++, data += width) {
+            uint32_t asn;
+            if (width == 4) {
+                memcpy(&asn, data, 4);
+                asn = ntohl(asn);
+            } else {
+                uint16_t asn2;
+                memcpy(&asn2, data, 2);
+                asn = ntohs(asn2);
+            }
+            hops.push_back(Hop { asn, (uint8_t) (type | (i == count - 1 ? SEGMENT_END : 0)) });
+        }
+    }
+
+    // back-to-back sequences are one (a long one is split on the wire), sets are not.
+    for (size_t i = 0; i + 1 < hops.size(); i++) {
+        uint8_t type = hops[i].segment & SEGMENT_TYPE;
+        if ((type == AS_SEQUENCE || type == AS_CONFED_SEQUENCE) && (hops[i + 1].segment & SEGMENT_TYPE) == type)
+            hops[i].segment = type;
+    }
+
+    path.node = buildLocked(s, hops.size(), NULL, [&hops](size_t i) { return hops[i]; });
+    return path;
+}
+
+/* a segment ends on SEGMENT_END, where the type changes, or at 255 ASes. */
+size_t BGPAsPath::encode(uint8_t *buffer, int width) const {
+    uint8_t *start = buffer, *count = NULL;
+
+    for (const Node *n = this->node; n; n = n->next) {
+        if (!count) {
+            *buffer++ = n->segment & SEGMENT_TYPE;
+            count = buffer++;
+            *count = 0;
+        }
+
+        if (width == 4) {
+            uint32_t asn = htonl(n->asn);
+            memcpy(buffer, &asn, 4);
+        } else {
+            uint16_t asn = htons(n->asn);
+            memcpy(buffer, &asn, 2);
+        }
+        buffer += width;
+
+        if (++*count == 255 || (n->segment & SEGMENT_END) || !n->next ||
+            (n->next->segment & SEGMENT_TYPE) != (n->segment & SEGMENT_TYPE)) count = NULL;
+    }
+
+    return buffer - start;
+}
+
+size_t BGPAsPath::encodedSize(int width) const {
+    size_t size = 0, count = 0;
+
+    for (const Node *n = this->node; n; n = n->next) {
+        if (!count) size += 2;
+        size += width;
+
+        if (++count == 255 || (n->segment & SEGMENT_END) || !n->next ||
+            (n->next->segment & SEGMENT_TYPE) != (n->segment & SEGMENT_TYPE)) count = 0;
+    }
+
+    return size;
+}
+
+BGPAsPath BGPAsPath::reconstruct(const BGPAsPath &as_path, const BGPAsPath &as4_path) {
+    // counted as in length(); AS4_PATH longer than AS_PATH: ignore it (RFC 6793 4.2.3).
+    if (!as4_path.node || as_path.length() < as4_path.length()) return as_path;
+
+    // confederation segments only come first, and AS4_PATH has none.
+    auto confed = [](const Node *n) {
+        uint8_t type = n->segment & SEGMENT_TYPE;
+        return type == AS_CONFED_SEQUENCE || type == AS_CONFED_SET;
+    };
+    if (as_path.length() == as4_path.length() && !confed(as_path.node)) return as4_path;
+
+    auto &s = store();
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    size_t slot = KeyHash()(Key { (uint32_t) (uintptr_t) as4_path.node, 0, as_path.node }) & (MEMO_SIZE - 1);
+    auto &memo = s.memo[slot];
+
+    BGPAsPath merged;
+    if (memo.as_path == as_path.node && memo.as4_path == as4_path.node) {
+        acquire(memo.result);
+        merged.node = memo.result;
+        return merged;
+    }
+
+    /* the leading part of AS_PATH that AS4_PATH does not cover, in front of
+     * AS4_PATH: confederation segments, then ASes until the length is that
+     * of AS_PATH. an AS_SET is taken whole, as it counts as one.
+     */
+    size_t lead = as_path.length() - as4_path.length(), counted = 0;
+    std::vector<Hop> hops;
+    for (const Node *n = as_path.node; n && (counted < lead || confed(n)); ) {
+        uint8_t type = n->segment & SEGMENT_TYPE;
+        bool end;
+        do {
+            end = type == AS_SEQUENCE || (n->segment & SEGMENT_END);
+            hops.push_back(Hop { n->asn, n->segment });
+            n = n->next;
+        } while (!end && n);
+        counted += type == AS_SEQUENCE || type == AS_SET;
+    }
+
+    merged.node = buildLocked(s, hops.size(), as4_path.node, [&hops](size_t i) { return hops[i]; });
+
+    releaseLocked(s, memo.as_path);
+    releaseLocked(s, memo.as4_path);
+    releaseLocked(s, memo.result);
+    memo.as_path = as_path.node;
+    memo.as4_path = as4_path.node;
+    memo.result = merged.node;
+    acquire(memo.as_path);
+    acquire(memo.as4_path);
+    acquire(memo.result);
+
+    return merged;
+}
+
+BGPAsPath BGPAsPath::prepend(uint32_t asn) const {
+    BGPAsPath path;
+    auto &s = store();
+    std::lock_guard<std::mutex> guard(s.lock);
+    // joins the first segment if that is a sequence already.
+    bool joins = this->node && (this->node->segment & SEGMENT_TYPE) == AS_SEQUENCE;
+    path.node = consLocked(s, asn, AS_SEQUENCE | (joins ? 0 : SEGMENT_END), this->node);
+    return path;
+}
+
+size_t BGPAsPath::size() const {
+    return this->node ? this->node->size : 0;
+}
+
+size_t BGPAsPath::length() const {
+    return this->node ? this->node->length : 0;
+}
+
+bool BGPAsPath::empty() const {
+    return !this->node;
+}
+
+uint32_t BGPAsPath::front() const {
+    return this->node ? this->node->asn : 0;
+}
+
+uint32_t BGPAsPath::origin() const {
+    return this->node ? this->node->origin : 0;
+}
+
+uint32_t BGPAsPath::at(size_t i) const {
+    const Node *n = this->node;
+    while (n && i--) n = n->next;
+    return n ? n->asn : 0;
+}
+
+bool BGPAsPath::contains(uint32_t asn) const {
+    for (const Node *n = this->node; n; n = n->next)
+        if (n->asn == asn) return true;
+    return false;
+}
+
+BGPAsPath::Iterator BGPAsPath::begin() const {
+    return Iterator(this->node);
+}
+
+BGPAsPath::Iterator BGPAsPath::end() const {
+    return Iterator(NULL);
+}
+
+std::vector<uint32_t> BGPAsPath::toVector() const {
+    std::vector<uint32_t> asns;
+    asns.reserve(this->size());
+    for (const Node *n = this->node; n; n = n->next) asns.push_back(n->asn);
+    return asns;
+}
+
+uint64_t BGPAsPath::id() const {
+    return this->node ? this->node->serial : 0;
+}
+
+size_t BGPAsPath::internedCount() {
+    auto &s = store();
+    std::lock_guard<std::mutex> guard(s.lock);
+    return s.nodes.size();
+}
+
+}
@@ -0,0 +1,92 @@
+#ifndef LIBBGP_ASPATH_H
+#define LIBBGP_ASPATH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace LibBGP {
+
+/* handle to an interned AS path. paths are hash-consed lists: a node is
+ * one AS, with the type of the segment it is in, plus the (interned) rest
+ * of the path toward the origin, so paths with the same tail share it, and
+ * equal paths are the same node. copying a handle is a reference count,
+ * comparing two is a pointer compare, and size(), length() and origin()
+ * are stored in the node.
+ */
+class BGPAsPath {
+public:
+    enum { AS_TRANS = 23456, MEMO_SIZE = 4096 };
+
+    // segment types, RFC 4271 4.3 and RFC 5065 3.
+    enum { AS_SET = 1, AS_SEQUENCE = 2, AS_CONFED_SEQUENCE = 3, AS_CONFED_SET = 4 };
+
+    struct Node;
+
+    class Iterator {
+    public:
+        Iterator(const Node *node) : node(node) {}
+        uint32_t operator* () const;
+        uint8_t segment() const; // type of the segment the AS is in
+        Iterator& operator++ ();
+        bool operator!= (const Iterator &other) const { return this->node != other.node; }
+        bool operator== (const Iterator &other) const { return this->node == other.node; }
+
+    private:
+        const Node *node;
+    };
+
+    BGPAsPath();
+    BGPAsPath(const BGPAsPath &other);
+    BGPAsPath& operator= (const BGPAsPath &other);
+    ~BGPAsPath();
+
+    // one AS_SEQUENCE.
+    static BGPAsPath intern(const uint32_t *asns, size_t count);
+    static BGPAsPath intern(const std::vector<uint32_t> &asns);
+
+    /* an AS_PATH or AS4_PATH value as on the wire, every segment of it, with
+     * ASNs of width 2 or 4 bytes. the segments must have been checked.
+     */
+    static BGPAsPath decode(const uint8_t *data, size_t length, int width);
+
+    // the segments back, as they came; a segment over 255 ASes is split.
+    size_t encode(uint8_t *buffer, int width) const;
+    size_t encodedSize(int width) const;
+
+    /* RFC 6793 4.2.3: the AS_PATH of a 2-byte speaker merged with its
+     * AS4_PATH, both counted as in length(). remembered per pair of paths, so it is worked out once per
+     * unique path rather than once per UPDATE.
+     */
+    static BGPAsPath reconstruct(const BGPAsPath &as_path, const BGPAsPath &as4_path);
+
+    BGPAsPath prepend(uint32_t asn) const;
+
+    size_t size() const; // ASes
+    size_t length() const; // for best-path: an AS_SET counts as one, confederation segments not at all
+    bool empty() const;
+    uint32_t front() const; // neighbor AS, 0 if empty
+    uint32_t origin() const; // 0 if empty
+    uint32_t at(size_t i) const; // walks the list
+    bool contains(uint32_t asn) const;
+
+    Iterator begin() const;
+    Iterator end() const;
+    std::vector<uint32_t> toVector() const;
+
+    // same for equal paths while one is alive, never given to another path. 0: empty.
+    uint64_t id() const;
+
+    bool operator== (const BGPAsPath &other) const { return this->node == other.node; }
+    bool operator!= (const BGPAsPath &other) const { return this->node != other.node; }
+
+    // nodes currently interned, shared tails counted once.
+    static size_t internedCount();
+
+private:
+    Node *node;
+};
+
+}
+
+#endif // LIBBGP_ASPATH_H
@@ -0,0 +1,361 @@
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include "aspath_regex.h"
+
+namespace LibBGP {
+
+BGPAsPathRegex::BGPAsPathRegex() {
+    this->pos = NULL;
+    this->failed = false;
+}
+
+int32_t BGPAsPathRegex::newState() {
+    this->nfa.push_back(std::vector<NfaEdge>());
+    return this->nfa.size() - 1;
+}
+
+void BGPAsPathRegex::addEdge(int32_t from, int32_t to, int32_t sym) {
+    NfaEdge edge;
+    edge.to = to;
+    edge.sym = sym;
+    this->nfa[from].push_back(edge);
+}
+
+BGPAsPathRegex::Fragment BGPAsPathRegex::anyRun() {
+    Fragment f;
+    f.start = f.end = this->newState();
+    this->addEdge(f.start, f.start, SYM_ANY);
+    return f;
+}
+
+BGPAsPathRegex::Fragment BGPAsPathRegex::parseAlternation(bool top) {
+    Fragment f = this->parseConcat(top);
+
+    while (!this->failed && *this->pos == '|') {
+        this->pos++;
+        Fragment alt = this->parseConcat(top);
+        Fragment both;
+        both.start = this->newState();
+        both.end = this->newState();
+        this->addEdge(both.start, f.start, SYM_EPSILON);
+        this->addEdge(both.start, alt.start, SYM_EPSILON);
+        this->addEdge(f.end, both.end, SYM_EPSILON);
+        this->addEdge(alt.end, both.end, SYM_EPSILON);
+        f = both;
+    }
+
+    return f;
+}
+
+BGPAsPathRegex::Fragment BGPAsPathRegex::parseConcat(bool top) {
+    Fragment f;
+    f.start = f.end = this->newState();
+    bool anchored_start = false, anchored_end = false, empty = true;
+
+    while (!this->failed && *this->pos && *this->pos != '|' && *this->pos != ')') {
+        char c = *this->pos;
+
+        if (c == '_' || c == ' ') {
+            this->pos++;
+            continue;
+        }
+
+        if (anchored_end) { this->failed = true; break; } // something after $
+
+        if (c == '^') {
+            if (!top || !empty || anchored_start) { this->failed = true; break; }
+            anchored_start = true;
+            this->pos++;
+            continue;
+        }
+
+        if (c == '$') {
+            if (!top) { this->failed = true; break; }
+            anchored_end = true;
+            this->pos++;
+            continue;
+        }
+
+        Fragment piece = this->parsePiece();
+        if (this->failed) break;
+        this->addEdge(f.end, piece.start, SYM_EPSILON);
+        f.end = piece.end;
+        empty = false;
+    }
+
+    if (top && !anchored_start) {
+        Fragment any = this->anyRun();
+        this->addEdge(any.end, f.start, SYM_EPSILON);
+        f.start = any.start;
+    }
+
+    if (top && !anchored_end) {
+        Fragment any = this->anyRun();
+        this->addEdge(f.end, any.start, SYM_EPSILON);
+        f.end = any.end;
+    }
+
+    return f;
+}
+
+BGPAsPathRegex::Fragment BGPAsPathRegex::parsePiece() {
+    Fragment atom = this->parseAtom();
+
+    while (!this->failed && (*this->pos == '*' || *this->pos == '+' || *this->pos == '?')) {
+        char op = *this->pos++;
+        Fragment f;
+        f.start = this->newState();
+        f.end = this->newState();
+        this->addEdge(f.start, atom.start, SYM_EPSILON);
+        this->addEdge(atom.end, f.end, SYM_EPSILON);
+        if (op != '?') this->addEdge(atom.end, atom.start, SYM_EPSILON);
+        if (op != '+') this->addEdge(f.start, f.end, SYM_EPSILON);
+        atom = f;
+    }
+
+    return atom;
+}
+
+BGPAsPathRegex::Fragment BGPAsPathRegex::parseAtom() {
+    Fragment f;
+    f.start = f.end = -1;
+    char c = *this->pos;
+
+    if (c >= '0' && c <= '9') {
+        uint64_t asn = 0;
+        while (*this->pos >= '0' && *this->pos <= '9') {
+            asn = asn * 10 + (*this->pos++ - '0');
+            if (asn > 0xffffffffULL) { this->failed = true; return f; }
+        }
+
+        this->parsed_literals.push_back(asn);
+        f.start = this->newState();
+        f.end = this->newState();
+        this->addEdge(f.start, f.end, this->parsed_literals.size() - 1);
+        return f;
+    }
+
+    if (c == '.' || c == '[' || c == '\\') {
+        if (c == '[') { // digit class, must be repeated to make up a whole AS
+            this->pos++;
+            while (*this->pos && *this->pos != ']') {
+                if (!((*this->pos >= '0' && *this->pos <= '9') || *this->pos == '-')) { this->failed = true; return f; }
+                this->pos++;
+            }
+            if (*this->pos != ']') { this->failed = true; return f; }
+            this->pos++;
+            if (*this->pos != '+' && *this->pos != '*') { this->failed = true; return f; }
+            this->pos++;
+        } else if (c == '\\') {
+            if (this->pos[1] != 'd' || (this->pos[2] != '+' && this->pos[2] != '*')) { this->failed = true; return f; }
+            this->pos += 3;
+        } else this->pos++;
+
+        f.start = this->newState();
+        f.end = this->newState();
+        this->addEdge(f.start, f.end, SYM_ANY);
+        return f;
+    }
+
+    if (c == '(') {
+        this->pos++;
+        f = this->parseAlternation(false);
+        if (this->failed) return f;
+        if (*this->pos != ')') { this->failed = true; return f; }
+        this->pos++;
+        return f;
+    }
+
+    this->failed = true;
+    return f;
+}
+
+bool BGPAsPathRegex::buildDfa(int32_t start, int32_t accept) {
+    // alphabet: class 0 is "any other AS", class n + 1 is literals[n].
+    this->literals = this->parsed_literals;
+    std::sort(this->literals.begin(), this->literals.end());
+    this->literals.erase(std::unique(this->literals.begin(), this->literals.end()), this->literals.end());
+
+    std::vector<uint32_t> sym_class;
+    for (auto asn : this->parsed_literals) sym_class.push_back(this->classOf(asn));
+
+    size_t stride = this->literals.size() + 1;
+
+    auto closure = [this](std::vector<int32_t> &set) {
+        std::vector<int32_t> stack = set;
+        std::vector<bool> seen(this->nfa.size(), false);
+        for (auto s : set) seen[s] = true;
+        while (stack.size()) {
+            int32_t s = stack.back();
+            stack.pop_back();
+            for (auto &e : this->nfa[s]) {
+                if (e.sym != SYM_EPSILON || seen[e.to]) continue;
+                seen[e.to] = true;
+                set.push_back(e.to);
+                stack.push_back(e.to);
+            }
+        }
+        std::sort(set.begin(), set.end());
+    };
+
+    std::map<std::vector<int32_t>, int32_t> ids;
+    std::vector<std::vector<int32_t>> sets;
+
+    std::vector<int32_t> init(1, start);
+    closure(init);
+    ids[init] = 0;
+    sets.push_back(init);
+
+    this->table.clear();
+    this->accepting.clear();
+
+    for (size_t d = 0; d < sets.size(); d++) {
+        if (sets.size() > MAX_STATES) return false;
+        this->table.resize((d + 1) * stride, -1);
+        this->accepting.push_back(std::binary_search(sets[d].begin(), sets[d].end(), accept) ? 1 : 0);
+
+        for (size_t cls = 0; cls < stride; cls++) {
+            std::vector<int32_t> next;
+            for (auto s : sets[d]) for (auto &e : this->nfa[s]) {
+                if (e.sym == SYM_EPSILON) continue;
+                if (e.sym == SYM_ANY || (cls && sym_class[e.sym] == cls)) next.push_back(e.to);
+            }
+            if (!next.size()) continue;
+
+            std::sort(next.begin(), next.end());
+            next.erase(std::unique(next.begin(), next.end()), next.end());
+            closure(next);
+
+            auto it = ids.find(next);
+            int32_t id;
+            if (it == ids.end()) {
+                id = sets.size();
+                ids[next] = id;
+                sets.push_back(next);
+            } else id = it->second;
+
+            this->table[d * stride + cls] = id;
+        }
+    }
+
+    // accepting states that can only loop back onto themselves end the match early.
+    for (size_t d = 0; d < sets.size(); d++) {
+        if (!this->accepting[d]) continue;
+        bool absorbing = true;
+        for (size_t cls = 0; cls < stride && absorbing; cls++)
+            absorbing = this->table[d * stride + cls] == (int32_t) d;
+        if (absorbing) this->accepting[d] = 2;
+    }
+
+    return true;
+}
+
+bool BGPAsPathRegex::compile(const char *regex) {
+    this->nfa.clear();
+    this->parsed_literals.clear();
+    this->table.clear();
+    this->accepting.clear();
+    this->cache.assign(CACHE_SIZE, 0);
+    this->pos = regex;
+    this->failed = false;
+
+    Fragment f = this->parseAlternation(true);
+    if (this->failed || *this->pos) {
+        this->table.clear();
+        return false;
+    }
+
+    bool ok = this->buildDfa(f.start, f.end);
+    this->nfa.clear();
+    this->parsed_literals.clear();
+    if (!ok) this->table.clear();
+    return ok;
+}
+
+bool BGPAsPathRegex::match(const uint8_t *data, size_t len, bool as4) const {
+    if (!this->table.size()) return false;
+
+    size_t stride = this->literals.size() + 1;
+    size_t width = as4 ? 4 : 2;
+    const uint8_t *end = data + len;
+    int32_t state = 0;
+
+    if (this->accepting[0] == 2) return true;
+
+    while (data < end) {
+        if (end - data < 2) return false;
+        size_t count = data[1];
+        data += 2;
+        if ((size_t) (end - data) < count * width) return false;
+
+        for (size_t i = 0; i < count; i++, data += width) {
+            uint32_t asn = as4 ?
+                ((uint32_t) data[0] << 24 | (uint32_t) data[1] << 16 | (uint32_t) data[2] << 8 | data[3]) :
+                ((uint32_t) data[0] << 8 | data[1]);
+            state = this->table[state * stride + this->classOf(asn)];
+            if (state < 0) return false;
+            if (this->accepting[state] == 2) return true;
+        }
+    }
+
+    return this->accepting[state] != 0;
+}
+
+template <typename Iterator> bool BGPAsPathRegex::matchAsns(Iterator begin, Iterator end) const {
+    if (!this->table.size()) return false;
+
+    size_t stride = this->literals.size() + 1;
+    int32_t state = 0;
+
+    if (this->accepting[0] == 2) return true;
+
+    for (; begin != end; ++begin) {
+        state = this->table[state * stride + this->classOf(*begin)];
+        if (state < 0) return false;
+        if (this->accepting[state] == 2) return true;
+    }
+
+    return this->accepting[state] != 0;
+}
+
+bool BGPAsPathRegex::match(const std::vector<uint32_t> &path) const {
+    return this->matchAsns(path.begin(), path.end());
+}
+
+bool BGPAsPathRegex::match(const BGPAsPath &path) const {
+    return this->matchAsns(path.begin(), path.end());
+}
+
+uint64_t* BGPAsPathRegex::cacheSlot(uint64_t path_id) const {
+    if (!this->cache.size()) return NULL;
+    uint64_t h = path_id * 0x9e3779b97f4a7c15ULL;
+    return &this->cache[(h >> 32) % CACHE_SIZE];
+}
+
+bool BGPAsPathRegex::matchCached(uint64_t path_id, const uint8_t *data, size_t len, bool as4) const {
+    uint64_t *slot = this->cacheSlot(path_id);
+    if (!slot) return false;
+
+    uint64_t entry = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    if (entry && entry >> 1 == path_id) return entry & 0x1;
+
+    bool result = this->match(data, len, as4);
+    __atomic_store_n(slot, path_id << 1 | result, __ATOMIC_RELAXED);
+    return result;
+}
+
+bool BGPAsPathRegex::matchCached(const BGPAsPath &path) const {
+    uint64_t *slot = this->cacheSlot(path.id());
+    if (!slot) return false;
+
+    uint64_t entry = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    if (entry && entry >> 1 == path.id()) return entry & 0x1;
+
+    bool result = this->match(path);
+    __atomic_store_n(slot, path.id() << 1 | result, __ATOMIC_RELAXED);
+    return result;
+}
+
+}
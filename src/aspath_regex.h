@@ -0,0 +1,89 @@
+#ifndef LIBBGP_ASPATH_REGEX_H
+#define LIBBGP_ASPATH_REGEX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include "aspath.h"
+
+namespace LibBGP {
+
+/* AS-path regular expression, compiled to a DFA over AS numbers rather than
+ * over characters. the dialect is the usual one, read at AS granularity:
+ *
+ *   65000          one AS, matched as a whole number (never a substring)
+ *   .              any one AS, so .* / .+ are any run of ASes
+ *   [0-9]+         any one AS (also [0-9]*, \d+)
+ *   _              AS boundary; separators are implicit, so it is skipped
+ *   ^ $            anchors, at the start / end of a top-level alternative
+ *   ( ) | * + ?    grouping, alternation and repetition
+ *
+ * members of an AS_SET are matched as if they were a sequence.
+ */
+class BGPAsPathRegex {
+public:
+    enum { MAX_STATES = 4096, CACHE_SIZE = 1024 };
+
+    BGPAsPathRegex();
+    bool compile(const char *regex);
+
+    // match encoded AS_PATH / AS4_PATH attribute value (segments), 2 or 4 byte ASNs.
+    bool match(const uint8_t *data, size_t len, bool as4) const;
+    bool match(const std::vector<uint32_t> &path) const;
+    bool match(const BGPAsPath &path) const;
+
+    /* same as match, with the result remembered for path_id, which must
+     * identify the path and never be reused, like BGPAsPath::id(). an entry
+     * is one word, so the cache may be used from several threads at once.
+     */
+    bool matchCached(uint64_t path_id, const uint8_t *data, size_t len, bool as4) const;
+    bool matchCached(const BGPAsPath &path) const;
+
+private:
+    typedef struct NfaEdge {
+        int32_t to;
+        int32_t sym; // SYM_EPSILON, SYM_ANY or index into literals
+    } NfaEdge;
+
+    typedef struct Fragment {
+        int32_t start;
+        int32_t end;
+    } Fragment;
+
+    enum { SYM_EPSILON = -2, SYM_ANY = -1 };
+
+    // parser, builds the nfa.
+    const char *pos;
+    bool failed;
+    std::vector<std::vector<NfaEdge>> nfa;
+    std::vector<uint32_t> parsed_literals; // sym -> asn, in parse order
+    int32_t newState();
+    void addEdge(int32_t from, int32_t to, int32_t sym);
+    Fragment parseAlternation(bool top);
+    Fragment parseConcat(bool top);
+    Fragment parsePiece();
+    Fragment parseAtom();
+    Fragment anyRun();
+    bool buildDfa(int32_t start, int32_t accept);
+    template <typename Iterator> bool matchAsns(Iterator begin, Iterator end) const;
+    uint64_t* cacheSlot(uint64_t path_id) const;
+
+    inline uint32_t classOf(uint32_t asn) const {
+        auto lo = this->literals.begin(), hi = this->literals.end();
+        while (lo < hi) {
+            auto mid = lo + (hi - lo) / 2;
+            if (*mid < asn) lo = mid + 1;
+            else hi = mid;
+        }
+        return (lo != this->literals.end() && *lo == asn) ? (lo - this->literals.begin()) + 1 : 0;
+    }
+
+    std::vector<uint32_t> literals; // sorted, class n + 1
+    std::vector<int32_t> table; // state * (literals + 1) + class -> state, -1: dead
+    std::vector<uint8_t> accepting; // 1: accepting, 2: accepting and absorbing
+    mutable std::vector<uint64_t> cache; // path_id << 1 | result, 0: empty
+};
+
+}
+
+#endif // LIBBGP_ASPATH_REGEX_H
@@ -0,0 +1,355 @@
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+#include "libbgp.h"
+#include "attribute.h"
+
+namespace LibBGP {
+
+namespace {
+
+template <typename T> T getValue(const uint8_t **buffer) {
+    T var;
+    memcpy(&var, *buffer, sizeof(T));
+    *buffer += sizeof(T);
+    return var;
+}
+
+template <typename T> int putValue(uint8_t **buffer, T value) {
+    memcpy(*buffer, &value, sizeof(T));
+    *buffer += sizeof(T);
+    return sizeof(T);
+}
+
+/* true if data is a well-formed list of AS_PATH segments of width-byte ASNs. */
+bool checkAsPath(const uint8_t *data, size_t len, size_t width) {
+    const uint8_t *end = data + len;
+    while (data < end) {
+        if (end - data < 2) return false;
+        uint8_t type = data[0], count = data[1];
+        if (type < 1 || type > 4 || count == 0) return false;
+        data += 2;
+        if ((size_t) (end - data) < count * width) return false;
+        data += count * width;
+    }
+    return true;
+}
+
+// every segment, as decodeAsPath() kept them.
+int encodeAsPath(const BGPASPath &as_path, uint8_t *buffer, bool as4) {
+    return as_path.path.encode(buffer, as4 ? 4 : 2);
+}
+
+size_t sizeOfAsPath(const BGPASPath &as_path, bool as4) {
+    return as_path.path.encodedSize(as4 ? 4 : 2);
+}
+
+// type and length are of the first segment.
+void decodeAsPath(BGPASPath &as_path, const uint8_t *value, size_t len, bool as4) {
+    as_path.type = value[0];
+    as_path.length = value[1];
+    as_path.path = BGPAsPath::decode(value, len, as4 ? 4 : 2);
+}
+
+/* the codec of one attribute type. the primary template is for the types
+ * without one of their own, see BGPAttributeRegistry.
+ */
+template <int Type> struct BGPAttributeCodec {
+    enum { WELL_KNOWN = 0, ON_ERROR = BGP_UPDATE_SESSION_RESET };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (!attr.optional) return 2; // Unrecognized Well-known Attribute
+        if (!attr.transitive) return BGPAttributeHandler::DROP;
+
+        attr.partial = true;
+        attr.value.assign(value, value + attr.length);
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        if (attr.value.size()) memcpy(buffer, attr.value.data(), attr.value.size());
+        return attr.value.size();
+    }
+
+    static size_t size(const BGPPathAttribute &attr) {
+        return attr.value.size();
+    }
+};
+
+template <> struct BGPAttributeCodec<1> { // ORIGIN
+    enum { WELL_KNOWN = 1, ON_ERROR = BGP_UPDATE_TREAT_AS_WITHDRAW };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length != 1) return 5; // Attribute Length Error
+        if (value[0] > 2) return 6; // Invalid ORIGIN Attribute
+        attr.origin = value[0];
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        return putValue<uint8_t> (&buffer, attr.origin);
+    }
+
+    static size_t size(const BGPPathAttribute &) { return 1; }
+};
+
+template <> struct BGPAttributeCodec<2> { // AS_PATH
+    enum { WELL_KNOWN = 1, ON_ERROR = BGP_UPDATE_TREAT_AS_WITHDRAW };
+
+    // the width is the session's, set in peer_as4_ok by the parser.
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (!checkAsPath(value, attr.length, attr.peer_as4_ok ? 4 : 2)) return 11; // Malformed AS_PATH
+        if (attr.length == 0) return 0;
+
+        decodeAsPath(attr.as_path, value, attr.length, attr.peer_as4_ok);
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        return encodeAsPath(attr.as_path, buffer, attr.peer_as4_ok);
+    }
+
+    static size_t size(const BGPPathAttribute &attr) {
+        return sizeOfAsPath(attr.as_path, attr.peer_as4_ok);
+    }
+};
+
+template <> struct BGPAttributeCodec<3> { // NEXT_HOP
+    enum { WELL_KNOWN = 1, ON_ERROR = BGP_UPDATE_TREAT_AS_WITHDRAW };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length != 4) return 5;
+        attr.next_hop = getValue<uint32_t> (&value); // kept in network byte order
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        return putValue<uint32_t> (&buffer, attr.next_hop);
+    }
+
+    static size_t size(const BGPPathAttribute &) { return 4; }
+};
+
+template <> struct BGPAttributeCodec<4> { // MULTI_EXIT_DISC
+    enum { WELL_KNOWN = 0, ON_ERROR = BGP_UPDATE_TREAT_AS_WITHDRAW };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length != 4) return 5;
+        attr.med = ntohl(getValue<uint32_t> (&value));
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        return putValue<uint32_t> (&buffer, htonl(attr.med));
+    }
+
+    static size_t size(const BGPPathAttribute &) { return 4; }
+};
+
+template <> struct BGPAttributeCodec<5> { // LOCAL_PREF
+    enum { WELL_KNOWN = 1, ON_ERROR = BGP_UPDATE_TREAT_AS_WITHDRAW };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length != 4) return 5;
+        attr.local_pref = ntohl(getValue<uint32_t> (&value));
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        return putValue<uint32_t> (&buffer, htonl(attr.local_pref));
+    }
+
+    static size_t size(const BGPPathAttribute &) { return 4; }
+};
+
+template <> struct BGPAttributeCodec<6> { // ATOMIC_AGGREGATE
+    enum { WELL_KNOWN = 1, ON_ERROR = BGP_UPDATE_ATTRIBUTE_DISCARD };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *) {
+        if (attr.length != 0) return 5;
+        attr.atomic_aggregate = true;
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &, uint8_t *) { return 0; }
+    static size_t size(const BGPPathAttribute &) { return 0; }
+};
+
+template <> struct BGPAttributeCodec<7> { // AGGREGATOR
+    enum { WELL_KNOWN = 0, ON_ERROR = BGP_UPDATE_ATTRIBUTE_DISCARD };
+
+    // the width is the session's, as for AS_PATH: 8 bytes between 4-byte
+    // speakers, 6 otherwise, anything else is malformed.
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length != (attr.peer_as4_ok ? 8 : 6)) return 5;
+
+        if (attr.peer_as4_ok) attr.aggregator_asn4 = ntohl(getValue<uint32_t> (&value));
+        else attr.aggregator_asn = ntohs(getValue<uint16_t> (&value));
+
+        attr.aggregator = getValue<uint32_t> (&value);
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        int len = 0;
+        if (attr.peer_as4_ok) len += putValue<uint32_t> (&buffer, htonl(attr.aggregator_asn4));
+        else len += putValue<uint16_t> (&buffer, htons(attr.aggregator_asn));
+        len += putValue<uint32_t> (&buffer, attr.aggregator);
+        return len;
+    }
+
+    static size_t size(const BGPPathAttribute &attr) { return attr.peer_as4_ok ? 8 : 6; }
+};
+
+template <> struct BGPAttributeCodec<8> { // COMMUNITIES
+    enum { WELL_KNOWN = 0, ON_ERROR = BGP_UPDATE_TREAT_AS_WITHDRAW };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length % 4) return 5;
+        std::vector<uint32_t> communities;
+        communities.reserve(attr.length / 4);
+        for (int i = 0; i < attr.length / 4; i++)
+            communities.push_back(ntohl(getValue<uint32_t> (&value)));
+        attr.communities = BGPCommunities::intern(communities);
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        int len = 0;
+        for (auto community : attr.communities)
+            len += putValue<uint32_t> (&buffer, htonl(community));
+        return len;
+    }
+
+    static size_t size(const BGPPathAttribute &attr) { return attr.communities.size() * 4; }
+};
+
+template <> struct BGPAttributeCodec<16> { // EXTENDED_COMMUNITIES
+    enum { WELL_KNOWN = 0, ON_ERROR = BGP_UPDATE_TREAT_AS_WITHDRAW };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length % 8) return 5;
+        std::vector<uint64_t> communities;
+        communities.reserve(attr.length / 8);
+        for (int i = 0; i < attr.length / 8; i++) {
+            uint64_t hi = ntohl(getValue<uint32_t> (&value));
+            uint64_t lo = ntohl(getValue<uint32_t> (&value));
+            communities.push_back(hi << 32 | lo);
+        }
+        attr.ext_communities = BGPExtCommunities::intern(communities);
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        int len = 0;
+        for (auto community : attr.ext_communities) {
+            len += putValue<uint32_t> (&buffer, htonl(community >> 32));
+            len += putValue<uint32_t> (&buffer, htonl(community & 0xffffffff));
+        }
+        return len;
+    }
+
+    static size_t size(const BGPPathAttribute &attr) { return attr.ext_communities.size() * 8; }
+};
+
+template <> struct BGPAttributeCodec<17> { // AS4_PATH
+    enum { WELL_KNOWN = 0, ON_ERROR = BGP_UPDATE_ATTRIBUTE_DISCARD };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length == 0 || !checkAsPath(value, attr.length, 4)) return 5;
+        decodeAsPath(attr.as4_path, value, attr.length, true);
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        return encodeAsPath(attr.as4_path, buffer, true);
+    }
+
+    static size_t size(const BGPPathAttribute &attr) {
+        return sizeOfAsPath(attr.as4_path, true);
+    }
+};
+
+template <> struct BGPAttributeCodec<18> { // AS4_AGGREGATOR
+    enum { WELL_KNOWN = 0, ON_ERROR = BGP_UPDATE_ATTRIBUTE_DISCARD };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length != 8) return 5;
+        attr.aggregator_asn4 = ntohl(getValue<uint32_t> (&value));
+        attr.aggregator = getValue<uint32_t> (&value);
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        int len = 0;
+        len += putValue<uint32_t> (&buffer, htonl(attr.aggregator_asn4));
+        len += putValue<uint32_t> (&buffer, attr.aggregator);
+        return len;
+    }
+
+    static size_t size(const BGPPathAttribute &) { return 8; }
+};
+
+template <> struct BGPAttributeCodec<32> { // LARGE_COMMUNITY
+    enum { WELL_KNOWN = 0, ON_ERROR = BGP_UPDATE_TREAT_AS_WITHDRAW };
+
+    static uint8_t decode(BGPPathAttribute &attr, const uint8_t *value) {
+        if (attr.length % 12) return 5;
+        std::vector<BGPLargeCommunity> communities;
+        communities.reserve(attr.length / 12);
+        for (int i = 0; i < attr.length / 12; i++) {
+            BGPLargeCommunity community;
+            community.global = ntohl(getValue<uint32_t> (&value));
+            community.local1 = ntohl(getValue<uint32_t> (&value));
+            community.local2 = ntohl(getValue<uint32_t> (&value));
+            communities.push_back(community);
+        }
+        removeRepeats(communities);
+        attr.large_communities = BGPLargeCommunities::intern(communities);
+        return 0;
+    }
+
+    static int encode(const BGPPathAttribute &attr, uint8_t *buffer) {
+        int len = 0;
+        for (auto &community : attr.large_communities) {
+            len += putValue<uint32_t> (&buffer, htonl(community.global));
+            len += putValue<uint32_t> (&buffer, htonl(community.local1));
+            len += putValue<uint32_t> (&buffer, htonl(community.local2));
+        }
+        return len;
+    }
+
+    static size_t size(const BGPPathAttribute &attr) { return attr.large_communities.size() * 12; }
+};
+
+// the table, one entry per type, generated from the codecs.
+template <int... I> struct Indices {};
+template <int N, int... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template <int... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+template <int Type> constexpr BGPAttributeHandler handlerOf() {
+    return BGPAttributeHandler {
+        &BGPAttributeCodec<Type>::decode, &BGPAttributeCodec<Type>::encode, &BGPAttributeCodec<Type>::size,
+        BGPAttributeCodec<Type>::ON_ERROR, BGPAttributeCodec<Type>::WELL_KNOWN != 0
+    };
+}
+
+template <int... I> constexpr BGPAttributeRegistry::Table makeTable(Indices<I...>) {
+    return BGPAttributeRegistry::Table { { handlerOf<I>()... } };
+}
+
+}
+
+// both constant-initialized, so usable from other static initializers.
+const BGPAttributeRegistry::Table BGPAttributeRegistry::builtin = makeTable(MakeIndices<256>::type());
+BGPAttributeRegistry::Table BGPAttributeRegistry::table = makeTable(MakeIndices<256>::type());
+
+void BGPAttributeRegistry::add(uint8_t type, const BGPAttributeHandler &handler) {
+    table.handlers[type] = handler;
+}
+
+void BGPAttributeRegistry::reset(uint8_t type) {
+    table.handlers[type] = builtin.handlers[type];
+}
+
+}
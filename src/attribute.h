@@ -0,0 +1,57 @@
+#ifndef LIBBGP_ATTRIBUTE_H
+#define LIBBGP_ATTRIBUTE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+namespace LibBGP {
+
+struct BGPPathAttribute;
+
+/* how one path attribute type is read and written. decode gets the
+ * attribute with its flags, type and length set and the length bytes of
+ * its value; encode writes the value only, exactly size() bytes of it.
+ */
+typedef struct BGPAttributeHandler {
+    enum { DROP = 0xff };
+
+    // 0, the UPDATE Message Error subcode if the value is malformed, or
+    // DROP to leave the attribute out quietly.
+    uint8_t (*decode)(BGPPathAttribute &attr, const uint8_t *value);
+    int (*encode)(const BGPPathAttribute &attr, uint8_t *buffer);
+    size_t (*size)(const BGPPathAttribute &attr);
+
+    uint8_t on_error; // BGPUpdateErrorAction for a malformed one (RFC 7606 7)
+    bool well_known; // must be sent transitive and not optional
+} BGPAttributeHandler;
+
+/* handlers by attribute type. the built-in types are each one
+ * specialization of a codec template in attribute.cc, put in a table at
+ * compile time. types without one are unrecognized (RFC 4271 5, 9): an
+ * optional transitive one keeps its value as it came in
+ * BGPPathAttribute::value and is passed on with Partial set, an optional
+ * non-transitive one is dropped, a well-known one is an Unrecognized
+ * Well-known Attribute error.
+ *
+ * add() is not synchronized with parsing or building: register handlers
+ * before the first message.
+ */
+class BGPAttributeRegistry {
+public:
+    static inline const BGPAttributeHandler& handler(uint8_t type) { return table.handlers[type]; }
+
+    static void add(uint8_t type, const BGPAttributeHandler &handler); // replaces a built-in one too
+    static void reset(uint8_t type); // back to the built-in handler
+
+    typedef struct Table {
+        BGPAttributeHandler handlers[256];
+    } Table;
+
+private:
+    static Table table;
+    static const Table builtin;
+};
+
+}
+
+#endif // LIBBGP_ATTRIBUTE_H
@@ -0,0 +1,341 @@
+#include <stdint.h>
+#include <string.h>
+#include <thread>
+#include "batch.h"
+
+namespace LibBGP {
+
+namespace {
+
+enum { HEADER_LENGTH = 19, MAX_LENGTH = 4096, MIN_BYTES_PER_THREAD = 256 * 1024 };
+
+typedef struct Message {
+    const uint8_t *body; // after the header
+    uint32_t length; // of the body
+    uint32_t input;
+} Message;
+
+typedef struct Work {
+    size_t begin, end; // messages
+    BGPRouteColumns rows;
+    BGPBatchDecoder::Sets sets;
+    std::vector<uint32_t> remap; // local id - 1 to the decoder's
+    size_t base; // first row in the output
+    uint64_t errors;
+} Work;
+
+// eight bytes at a time, the sets are a few dozen bytes each.
+uint64_t hashOf(const uint8_t *data, size_t length) {
+    uint64_t h = length * 0x9e3779b97f4a7c15ULL, word;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    word = 0;
+    memcpy(&word, data + i, length - i);
+    h = (h ^ word) * 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 29);
+}
+
+inline uint16_t get16(const uint8_t *p) {
+    return (p[0] << 8) | p[1];
+}
+
+inline uint32_t getAsn(const uint8_t *p, int width) {
+    return width == 4 ? ((uint32_t) get16(p) << 16) | get16(p + 2) : get16(p);
+}
+
+const uint8_t* readPrefix(const uint8_t *p, const uint8_t *end, bool add_path, uint32_t *prefix, uint8_t *length) {
+    if (add_path) {
+        if (end - p < 4) return NULL;
+        p += 4;
+    }
+
+    if (p >= end || *p > 32) return NULL;
+    *length = *p++;
+
+    size_t bytes = (*length + 7) / 8;
+    if ((size_t) (end - p) < bytes) return NULL;
+    *prefix = 0;
+    memcpy(prefix, p, bytes);
+    return p + bytes;
+}
+
+// origin AS is the last one on the path, whatever segment it is in.
+bool scanAsPath(const uint8_t *p, size_t length, int width, uint32_t *origin, uint32_t *count) {
+    *origin = 0;
+    *count = 0;
+
+    while (length) {
+        if (length < 2) return false;
+        uint8_t type = p[0], asns = p[1];
+        size_t bytes = 2 + asns * width;
+        if (type < 1 || type > 4 || !asns || bytes > length) return false;
+
+        if (type == 1) *count += 1; // AS_SET
+        else if (type == 2) *count += asns; // AS_SEQUENCE, confederation segments do not count
+        *origin = getAsn(p + bytes - width, width);
+
+        p += bytes;
+        length -= bytes;
+    }
+
+    return true;
+}
+
+bool decodeUpdate(const Message &msg, const BGPBatchInput &input, Work &work) {
+    const uint8_t *p = msg.body, *end = msg.body + msg.length;
+    auto &rows = work.rows;
+
+    if (msg.length < 4) return false;
+    uint16_t withdrawn_len = get16(p);
+    p += 2;
+    if (end - p < withdrawn_len + 2) return false;
+
+    const uint8_t *withdrawn_end = p + withdrawn_len;
+    while (p < withdrawn_end) {
+        uint32_t prefix;
+        uint8_t length;
+        if (!(p = readPrefix(p, withdrawn_end, input.add_path, &prefix, &length))) return false;
+
+        rows.timestamp.push_back(input.timestamp);
+        rows.peer.push_back(input.peer);
+        rows.prefix.push_back(prefix);
+        rows.length.push_back(length);
+        rows.announce.push_back(0);
+        rows.origin_as.push_back(0);
+        rows.path_length.push_back(0);
+        rows.attributes.push_back(0);
+    }
+
+    uint16_t attrs_len = get16(p);
+    p += 2;
+    if (end - p < attrs_len) return false;
+
+    const uint8_t *attrs = p, *attrs_end = p + attrs_len;
+    uint32_t origin = 0, path_length = 0, as4_origin = 0, as4_length = 0;
+    bool has_as4 = false;
+
+    while (p < attrs_end) {
+        if (attrs_end - p < 3) return false;
+        uint8_t flags = p[0], type = p[1];
+        size_t length;
+        if (flags & 0x10) { // extended length
+            if (attrs_end - p < 4) return false;
+            length = get16(p + 2);
+            p += 4;
+        } else {
+            length = p[2];
+            p += 3;
+        }
+        if ((size_t) (attrs_end - p) < length) return false;
+
+        if (type == 2 && !scanAsPath(p, length, input.as4 ? 4 : 2, &origin, &path_length)) return false;
+        if (type == 17 && !input.as4) {
+            if (!scanAsPath(p, length, 4, &as4_origin, &as4_length)) return false;
+            has_as4 = true;
+        }
+        p += length;
+    }
+
+    // RFC 6793 4.2.3: AS4_PATH is only used if it is no longer than AS_PATH.
+    if (has_as4 && as4_length <= path_length && as4_origin) origin = as4_origin;
+
+    if (p == end) return true;
+
+    uint32_t id = work.sets.intern(attrs, attrs_len, hashOf(attrs, attrs_len));
+
+    while (p < end) {
+        uint32_t prefix;
+        uint8_t length;
+        if (!(p = readPrefix(p, end, input.add_path, &prefix, &length))) return false;
+
+        rows.timestamp.push_back(input.timestamp);
+        rows.peer.push_back(input.peer);
+        rows.prefix.push_back(prefix);
+        rows.length.push_back(length);
+        rows.announce.push_back(1);
+        rows.origin_as.push_back(origin);
+        rows.path_length.push_back(path_length > 0xffff ? 0xffff : path_length);
+        rows.attributes.push_back(id);
+    }
+
+    return true;
+}
+
+void decodeRange(const std::vector<Message> &messages, const std::vector<BGPBatchInput> &inputs, Work &work) {
+    for (size_t i = work.begin; i < work.end; i++) {
+        size_t mark = work.rows.size();
+        auto &msg = messages[i];
+        if (decodeUpdate(msg, inputs[msg.input], work)) continue;
+        work.rows.resize(mark);
+        work.errors++;
+    }
+}
+
+template <typename T> void copyColumn(BGPColumn<T> &to, const BGPColumn<T> &from, size_t base) {
+    if (from.size()) memcpy(to.data() + base, from.data(), from.size() * sizeof(T));
+}
+
+void copyRows(BGPRouteColumns &columns, const Work &work) {
+    auto &rows = work.rows;
+    copyColumn(columns.timestamp, rows.timestamp, work.base);
+    copyColumn(columns.peer, rows.peer, work.base);
+    copyColumn(columns.prefix, rows.prefix, work.base);
+    copyColumn(columns.length, rows.length, work.base);
+    copyColumn(columns.announce, rows.announce, work.base);
+    copyColumn(columns.origin_as, rows.origin_as, work.base);
+    copyColumn(columns.path_length, rows.path_length, work.base);
+
+    uint32_t *to = columns.attributes.data() + work.base;
+    for (size_t i = 0; i < rows.attributes.size(); i++) {
+        uint32_t id = rows.attributes[i];
+        to[i] = id ? work.remap[id - 1] : 0;
+    }
+}
+
+}
+
+size_t BGPRouteColumns::size() const {
+    return this->prefix.size();
+}
+
+void BGPRouteColumns::resize(size_t size) {
+    this->timestamp.resize(size);
+    this->peer.resize(size);
+    this->prefix.resize(size);
+    this->length.resize(size);
+    this->announce.resize(size);
+    this->origin_as.resize(size);
+    this->path_length.resize(size);
+    this->attributes.resize(size);
+}
+
+void BGPRouteColumns::clear() {
+    this->resize(0);
+}
+
+BGPBatchDecoder::Sets::Sets() {
+    this->offsets.push_back(0);
+}
+
+uint32_t BGPBatchDecoder::Sets::intern(const uint8_t *data, size_t length, uint64_t hash) {
+    if ((this->hashes.size() + 1) * 2 > this->index.size()) {
+        size_t size = this->index.size() ? this->index.size() * 2 : 1024;
+        this->index.assign(size, 0);
+        for (uint32_t id = 1; id <= this->hashes.size(); id++) {
+            size_t slot = this->hashes[id - 1] & (size - 1);
+            while (this->index[slot]) slot = (slot + 1) & (size - 1);
+            this->index[slot] = id;
+        }
+    }
+
+    size_t mask = this->index.size() - 1;
+    size_t slot = hash & mask;
+    for (; this->index[slot]; slot = (slot + 1) & mask) {
+        uint32_t id = this->index[slot];
+        uint64_t begin = this->offsets[id - 1];
+        if (this->hashes[id - 1] == hash && this->offsets[id] - begin == length &&
+            !memcmp(this->bytes.data() + begin, data, length)) return id;
+    }
+
+    this->bytes.insert(this->bytes.end(), data, data + length);
+    this->offsets.push_back(this->bytes.size());
+    this->hashes.push_back(hash);
+    return this->index[slot] = this->hashes.size();
+}
+
+BGPBatchDecoder::BGPBatchDecoder(int threads) {
+    this->threads = threads > 0 ? threads : std::thread::hardware_concurrency();
+    if (this->threads < 1) this->threads = 1;
+    this->message_count = 0;
+    this->error_count = 0;
+}
+
+void BGPBatchDecoder::decode(const std::vector<BGPBatchInput> &inputs, BGPRouteColumns &columns) {
+    // split: a walk over the headers only, the bodies are left for the threads.
+    std::vector<Message> messages;
+    size_t bytes = 0;
+    for (uint32_t i = 0; i < inputs.size(); i++) {
+        const uint8_t *p = inputs[i].buffer, *end = p + inputs[i].length;
+        while (p < end) {
+            size_t length = end - p >= HEADER_LENGTH ? get16(p + 16) : 0;
+            if (length < HEADER_LENGTH || length > MAX_LENGTH || length > (size_t) (end - p) ||
+                memcmp(p, "\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff\xff", 16)) {
+                this->error_count++;
+                break;
+            }
+
+            this->message_count++;
+            if (p[18] == 2) {
+                messages.push_back(Message { p + HEADER_LENGTH, (uint32_t) (length - HEADER_LENGTH), i });
+                bytes += length;
+            }
+            p += length;
+        }
+    }
+    if (!messages.size()) return;
+
+    size_t count = this->threads;
+    if (count > bytes / MIN_BYTES_PER_THREAD) count = bytes / MIN_BYTES_PER_THREAD;
+    if (count < 1) count = 1;
+
+    // ranges of about bytes / count each.
+    std::vector<Work> work(count);
+    size_t at = 0, seen = 0;
+    for (size_t t = 0; t < count; t++) {
+        work[t].begin = at;
+        size_t until = bytes * (t + 1) / count;
+        while (at < messages.size() && (seen < until || t == count - 1)) seen += messages[at++].length + HEADER_LENGTH;
+        work[t].end = at;
+        work[t].errors = 0;
+    }
+
+    std::vector<std::thread> running;
+    for (size_t t = 1; t < count; t++) running.emplace_back(decodeRange, std::cref(messages), std::cref(inputs), std::ref(work[t]));
+    decodeRange(messages, inputs, work[0]);
+    for (auto &thread : running) thread.join();
+    running.clear();
+
+    // the threads' sets in the decoder's, in input order so IDs do not depend on timing.
+    size_t rows = columns.size();
+    for (auto &w : work) {
+        auto &sets = w.sets;
+        w.remap.resize(sets.hashes.size());
+        for (size_t id = 0; id < sets.hashes.size(); id++) {
+            uint64_t begin = sets.offsets[id];
+            w.remap[id] = this->sets.intern(sets.bytes.data() + begin, sets.offsets[id + 1] - begin, sets.hashes[id]);
+        }
+        w.base = rows;
+        rows += w.rows.size();
+        this->error_count += w.errors;
+    }
+
+    columns.resize(rows);
+    for (size_t t = 1; t < count; t++) running.emplace_back(copyRows, std::ref(columns), std::cref(work[t]));
+    copyRows(columns, work[0]);
+    for (auto &thread : running) thread.join();
+}
+
+const uint8_t* BGPBatchDecoder::attributes(uint32_t id, size_t *length) const {
+    if (!id || id > this->sets.hashes.size()) return NULL;
+    uint64_t begin = this->sets.offsets[id - 1];
+    *length = this->sets.offsets[id] - begin;
+    return this->sets.bytes.data() + begin;
+}
+
+size_t BGPBatchDecoder::attributeSets() const {
+    return this->sets.hashes.size();
+}
+
+uint64_t BGPBatchDecoder::messages() const {
+    return this->message_count;
+}
+
+uint64_t BGPBatchDecoder::errors() const {
+    return this->error_count;
+}
+
+}
@@ -0,0 +1,148 @@
+#ifndef LIBBGP_BATCH_H
+#define LIBBGP_BATCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <type_traits>
+#include <vector>
+
+namespace LibBGP {
+
+/* growable array of plain values, for columns: one allocation, and growing
+ * it does not initialize what it adds, so filling a column writes it once.
+ */
+template <typename T> class BGPColumn {
+    static_assert(std::is_trivially_copyable<T>::value, "columns hold plain values");
+
+public:
+    BGPColumn() {
+        this->items = NULL;
+        this->count = 0;
+        this->capacity = 0;
+    }
+
+    ~BGPColumn() {
+        free(this->items);
+    }
+
+    T* data() { return this->items; }
+    const T* data() const { return this->items; }
+    const T* begin() const { return this->items; }
+    const T* end() const { return this->items + this->count; }
+
+    size_t size() const { return this->count; }
+    T& operator[] (size_t i) { return this->items[i]; }
+    const T& operator[] (size_t i) const { return this->items[i]; }
+
+    void push_back(T value) {
+        if (this->count == this->capacity) this->reserve(this->capacity ? this->capacity * 2 : 1024);
+        this->items[this->count++] = value;
+    }
+
+    void resize(size_t size) { // new values are left as they are
+        this->reserve(size);
+        this->count = size;
+    }
+
+    void clear() {
+        this->count = 0;
+    }
+
+    void reserve(size_t capacity) {
+        if (capacity <= this->capacity) return;
+        this->items = (T *) realloc(this->items, capacity * sizeof(T));
+        this->capacity = capacity;
+    }
+
+private:
+    BGPColumn(const BGPColumn &) = delete;
+    BGPColumn& operator= (const BGPColumn &) = delete;
+
+    T *items;
+    size_t count;
+    size_t capacity;
+};
+
+/* routes, one per row: row i of every column is the same prefix of the same
+ * UPDATE. rows are in input order, a message's withdrawn routes before its
+ * nlri.
+ */
+typedef struct BGPRouteColumns {
+    BGPColumn<uint64_t> timestamp; // of the input the message came in
+    BGPColumn<uint32_t> peer; // same
+    BGPColumn<uint32_t> prefix; // network byte order
+    BGPColumn<uint8_t> length;
+    BGPColumn<uint8_t> announce; // 1: nlri, 0: withdrawn
+    BGPColumn<uint32_t> origin_as; // 0: withdrawn, or no AS_PATH
+    BGPColumn<uint16_t> path_length; // an AS_SET counts as one (RFC 4271 9.1.2.2)
+    BGPColumn<uint32_t> attributes; // BGPBatchDecoder::attributes() id, 0: withdrawn
+
+    size_t size() const;
+    void resize(size_t size);
+    void clear();
+} BGPRouteColumns;
+
+/* concatenated BGP messages, as they came from one peer: the messages of an
+ * archived record, or a whole capture of one session.
+ */
+typedef struct BGPBatchInput {
+    const uint8_t *buffer;
+    size_t length;
+
+    uint64_t timestamp; // put in every row from this input, in the caller's unit
+    uint32_t peer; // same
+    bool as4; // the session had 4-byte ASNs (RFC 6793): AS_PATH carries them
+    bool add_path; // prefixes carry path IDs (RFC 7911)
+} BGPBatchInput;
+
+/* decodes UPDATEs straight into columns, without a BGPPacket per message.
+ * the inputs are split at message headers, and the messages decoded in
+ * ranges of about the same size, one thread each. every thread interns the
+ * attribute sets it sees on its own; their IDs are mapped to the decoder's
+ * once all are done, then the rows copied into place, again in parallel.
+ *
+ * attribute IDs hold across decode() calls. one decode() at a time.
+ */
+class BGPBatchDecoder {
+public:
+    BGPBatchDecoder(int threads = 0); // 0: one per core
+
+    /* appends the routes of every UPDATE in inputs to columns. other
+     * message types are passed over. so is a malformed UPDATE, and the rest
+     * of an input after a header that does not check out; both count in
+     * errors().
+     */
+    void decode(const std::vector<BGPBatchInput> &inputs, BGPRouteColumns &columns);
+
+    /* the path attributes of set id, as on the wire. valid until the next
+     * decode(); NULL for 0 or an unknown id.
+     */
+    const uint8_t* attributes(uint32_t id, size_t *length) const;
+    size_t attributeSets() const;
+
+    uint64_t messages() const; // every type, malformed ones included
+    uint64_t errors() const;
+
+    typedef struct Sets {
+        std::vector<uint8_t> bytes;
+        std::vector<uint64_t> offsets; // of set id - 1 in bytes, and the end
+        std::vector<uint64_t> hashes;
+        std::vector<uint32_t> index; // open addressing, id, 0: empty
+
+        Sets();
+        uint32_t intern(const uint8_t *data, size_t length, uint64_t hash);
+    } Sets;
+
+private:
+    BGPBatchDecoder(const BGPBatchDecoder &) = delete;
+    BGPBatchDecoder& operator= (const BGPBatchDecoder &) = delete;
+
+    int threads;
+    Sets sets;
+    uint64_t message_count;
+    uint64_t error_count;
+};
+
+}
+
+#endif // LIBBGP_BATCH_H
@@ -0,0 +1,363 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <algorithm>
+#include "bmp.h"
+
+namespace LibBGP {
+
+namespace {
+
+template <typename T> size_t putValue(uint8_t **buffer, T value) {
+    memcpy(*buffer, &value, sizeof(T));
+    *buffer += sizeof(T);
+    return sizeof(T);
+}
+
+}
+
+BGPBmpPeer::BGPBmpPeer() {
+    memset(this, 0, sizeof(BGPBmpPeer));
+}
+
+BGPBmpExporter::BGPBmpExporter(size_t queue_size) : queue(queue_size) {
+    this->sock = -1;
+    this->state = NORMAL;
+    this->head = 0;
+    this->used = 0;
+    this->dropped = 0;
+    this->messages = 0;
+    this->restart = true;
+}
+
+BGPBmpExporter::~BGPBmpExporter() {
+    this->disconnect();
+}
+
+bool BGPBmpExporter::connectUnix(const char *path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) return false;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return false;
+    }
+
+    this->attach(fd);
+    return true;
+}
+
+bool BGPBmpExporter::connectTcp(const char *address, uint16_t port) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &addr.sin_addr) != 1) return false;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) return false;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    // writes just see EAGAIN until the handshake is done.
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return false;
+    }
+
+    this->attach(fd);
+    return true;
+}
+
+void BGPBmpExporter::attach(int fd) {
+    this->disconnect();
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    this->sock = fd;
+
+    // anything sent or dropped before went to another connection.
+    if (this->messages || this->dropped) {
+        this->state = DRAINING;
+        this->restart = true;
+    }
+}
+
+void BGPBmpExporter::disconnect() {
+    if (this->sock >= 0) close(this->sock);
+    this->sock = -1;
+    this->head = 0;
+    this->used = 0;
+}
+
+void BGPBmpExporter::setResync(const std::function<bool (BGPBmpExporter &, bool restart)> &step) {
+    this->resync = step;
+}
+
+void BGPBmpExporter::broken() {
+    this->disconnect();
+    this->state = DRAINING;
+    this->restart = true;
+}
+
+void BGPBmpExporter::enqueue(const uint8_t *data, size_t length) {
+    size_t capacity = this->queue.size();
+    size_t tail = (this->head + this->used) % capacity;
+    size_t first = std::min(length, capacity - tail);
+    memcpy(&this->queue[tail], data, first);
+    memcpy(&this->queue[0], data + first, length - first);
+    this->used += length;
+}
+
+bool BGPBmpExporter::writeQueue() {
+    size_t capacity = this->queue.size();
+
+    while (this->used && this->sock >= 0) {
+        struct iovec iov[2];
+        size_t first = std::min(this->used, capacity - this->head);
+        iov[0].iov_base = &this->queue[this->head];
+        iov[0].iov_len = first;
+        iov[1].iov_base = &this->queue[0];
+        iov[1].iov_len = this->used - first;
+
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = iov[1].iov_len ? 2 : 1;
+
+        ssize_t n = sendmsg(this->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR || errno == ENOTCONN) return true;
+            this->broken();
+            return false;
+        }
+
+        this->head = (this->head + n) % capacity;
+        this->used -= n;
+    }
+
+    if (!this->used) this->head = 0;
+    return this->sock >= 0;
+}
+
+bool BGPBmpExporter::send(uint8_t type, const BGPBmpPeer *peer, struct iovec *body, int body_count) {
+    uint8_t header[6 + 42];
+    uint8_t *ptr = header;
+    size_t header_len = 6 + (peer ? 42 : 0);
+    size_t total = header_len;
+    for (int i = 0; i < body_count; i++) total += body[i].iov_len;
+
+    // waiting for the queue to drain before a resync, or nowhere to send to.
+    if (this->state == DRAINING || this->sock < 0 || total > this->queue.size() - this->used) {
+        this->dropped++;
+        if (this->state != DRAINING) {
+            this->state = DRAINING;
+            this->restart = true;
+        }
+        return false;
+    }
+
+    putValue<uint8_t> (&ptr, 3); // version
+    putValue<uint32_t> (&ptr, htonl(total));
+    putValue<uint8_t> (&ptr, type);
+
+    if (peer) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        putValue<uint8_t> (&ptr, peer->type);
+        putValue<uint8_t> (&ptr, peer->flags);
+        putValue<uint32_t> (&ptr, htonl(peer->distinguisher >> 32));
+        putValue<uint32_t> (&ptr, htonl(peer->distinguisher & 0xffffffff));
+        memset(ptr, 0, 12); // IPv4 goes in the last 4 bytes of the address
+        ptr += 12;
+        putValue<uint32_t> (&ptr, peer->address);
+        putValue<uint32_t> (&ptr, htonl(peer->asn));
+        putValue<uint32_t> (&ptr, peer->bgp_id);
+        putValue<uint32_t> (&ptr, htonl(now.tv_sec));
+        putValue<uint32_t> (&ptr, htonl(now.tv_usec));
+    }
+
+    struct iovec iov[8];
+    iov[0].iov_base = header;
+    iov[0].iov_len = header_len;
+    for (int i = 0; i < body_count; i++) iov[i + 1] = body[i];
+
+    // nothing queued: the caller's buffers go to the socket as they are.
+    size_t written = 0;
+    if (!this->used) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = body_count + 1;
+
+        ssize_t n = sendmsg(this->sock, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ENOTCONN) {
+            this->broken();
+            this->dropped++;
+            return false;
+        }
+        if (n > 0) written = n;
+    }
+
+    for (int i = 0; i <= body_count; i++) {
+        if (written >= iov[i].iov_len) {
+            written -= iov[i].iov_len;
+            continue;
+        }
+        this->enqueue((const uint8_t *) iov[i].iov_base + written, iov[i].iov_len - written);
+        written = 0;
+    }
+
+    this->messages++;
+    return true;
+}
+
+bool BGPBmpExporter::initiation(const char *sys_name, const char *sys_descr) {
+    uint8_t tlv[2][4];
+    struct iovec body[4];
+    const char *values[2] = { sys_descr, sys_name };
+
+    for (int i = 0; i < 2; i++) {
+        uint8_t *ptr = tlv[i];
+        size_t len = strlen(values[i]);
+        putValue<uint16_t> (&ptr, htons(i + 1)); // 1: sysDescr, 2: sysName
+        putValue<uint16_t> (&ptr, htons(len));
+        body[i * 2].iov_base = tlv[i];
+        body[i * 2].iov_len = 4;
+        body[i * 2 + 1].iov_base = (void *) values[i];
+        body[i * 2 + 1].iov_len = len;
+    }
+
+    return this->send(4, NULL, body, 4);
+}
+
+bool BGPBmpExporter::termination(uint16_t reason) {
+    uint8_t tlv[6];
+    uint8_t *ptr = tlv;
+    putValue<uint16_t> (&ptr, htons(1)); // reason
+    putValue<uint16_t> (&ptr, htons(2));
+    putValue<uint16_t> (&ptr, htons(reason));
+
+    struct iovec body;
+    body.iov_base = tlv;
+    body.iov_len = sizeof(tlv);
+    return this->send(5, NULL, &body, 1);
+}
+
+bool BGPBmpExporter::routeMonitoring(const BGPBmpPeer &peer, const uint8_t *update, size_t length) {
+    struct iovec body;
+    body.iov_base = (void *) update;
+    body.iov_len = length;
+    return this->send(0, &peer, &body, 1);
+}
+
+bool BGPBmpExporter::peerUp(const BGPBmpPeer &peer, uint32_t local_address, uint16_t local_port, uint16_t remote_port,
+    const uint8_t *sent_open, size_t sent_length, const uint8_t *received_open, size_t received_length) {
+    uint8_t fixed[20];
+    uint8_t *ptr = fixed;
+    memset(ptr, 0, 12);
+    ptr += 12;
+    putValue<uint32_t> (&ptr, local_address);
+    putValue<uint16_t> (&ptr, htons(local_port));
+    putValue<uint16_t> (&ptr, htons(remote_port));
+
+    struct iovec body[3];
+    body[0].iov_base = fixed;
+    body[0].iov_len = sizeof(fixed);
+    body[1].iov_base = (void *) sent_open;
+    body[1].iov_len = sent_length;
+    body[2].iov_base = (void *) received_open;
+    body[2].iov_len = received_length;
+    return this->send(3, &peer, body, 3);
+}
+
+bool BGPBmpExporter::peerDown(const BGPBmpPeer &peer, uint8_t reason, const uint8_t *data, size_t length) {
+    struct iovec body[2];
+    body[0].iov_base = &reason;
+    body[0].iov_len = 1;
+    body[1].iov_base = (void *) data;
+    body[1].iov_len = data ? length : 0;
+    return this->send(2, &peer, body, 2);
+}
+
+bool BGPBmpExporter::statsReport(const BGPBmpPeer &peer, const BGPParseContext &counters, uint64_t adj_rib_in_routes, uint64_t loc_rib_routes) {
+    uint8_t stats[4 + 2 * 8 + 2 * 12];
+    uint8_t *ptr = stats;
+
+    putValue<uint32_t> (&ptr, htonl(4));
+
+    // 32-bit counters: 0: prefixes rejected by inbound policy, 11: updates treated as withdraw.
+    uint16_t counter_types[2] = { 0, 11 };
+    uint64_t counter_values[2] = { counters.prefixes_filtered, counters.updates_treated_as_withdraw };
+    for (int i = 0; i < 2; i++) {
+        putValue<uint16_t> (&ptr, htons(counter_types[i]));
+        putValue<uint16_t> (&ptr, htons(4));
+        putValue<uint32_t> (&ptr, htonl((uint32_t) counter_values[i]));
+    }
+
+    // 64-bit gauges: 7: routes in Adj-RIB-In, 8: routes in Loc-RIB.
+    uint16_t gauge_types[2] = { 7, 8 };
+    uint64_t gauge_values[2] = { adj_rib_in_routes, loc_rib_routes };
+    for (int i = 0; i < 2; i++) {
+        putValue<uint16_t> (&ptr, htons(gauge_types[i]));
+        putValue<uint16_t> (&ptr, htons(8));
+        putValue<uint32_t> (&ptr, htonl(gauge_values[i] >> 32));
+        putValue<uint32_t> (&ptr, htonl(gauge_values[i] & 0xffffffff));
+    }
+
+    struct iovec body;
+    body.iov_base = stats;
+    body.iov_len = sizeof(stats);
+    return this->send(1, &peer, &body, 1);
+}
+
+bool BGPBmpExporter::flush() {
+    if (!this->writeQueue()) return false;
+
+    if (this->state == DRAINING && !this->used && this->sock >= 0)
+        this->state = this->resync ? RESYNC : NORMAL;
+
+    // dump while the queue is less than half full, leaving room for live updates.
+    while (this->state == RESYNC && this->used < this->queue.size() / 2) {
+        bool restart = this->restart;
+        this->restart = false;
+        if (!this->resync(*this, restart)) {
+            if (this->state == RESYNC) this->state = NORMAL;
+            break;
+        }
+        if (!this->writeQueue()) return false;
+    }
+
+    return true;
+}
+
+int BGPBmpExporter::fd() const {
+    return this->sock;
+}
+
+bool BGPBmpExporter::pending() const {
+    return this->used > 0 || this->state != NORMAL;
+}
+
+uint64_t BGPBmpExporter::drops() const {
+    return this->dropped;
+}
+
+uint64_t BGPBmpExporter::sent() const {
+    return this->messages;
+}
+
+bool BGPBmpExporter::resyncing() const {
+    return this->state != NORMAL;
+}
+
+}
@@ -0,0 +1,98 @@
+#ifndef LIBBGP_BMP_H
+#define LIBBGP_BMP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <functional>
+#include <vector>
+#include "libbgp.h"
+
+namespace LibBGP {
+
+/* RFC 7854 per-peer header fields. */
+typedef struct BGPBmpPeer {
+    uint8_t type; // 0: global instance peer
+    uint8_t flags; // 0x20: A, peer uses 2-byte AS_PATH
+    uint64_t distinguisher;
+    uint32_t address; // IPv4, network byte order
+    uint32_t asn;
+    uint32_t bgp_id; // network byte order
+
+    BGPBmpPeer();
+} BGPBmpPeer;
+
+/* BMP exporter. messages go to the collector socket through a bounded byte
+ * queue and the socket is never waited on: when the queue is empty a
+ * message is written straight from the caller's buffers, and whatever the
+ * socket does not take is queued. when a message does not fit, it is
+ * dropped and counted, and the exporter stops taking messages until the
+ * queue drains. it then runs the resync step (e.g. a walk over a RIB
+ * snapshot sending Peer Up and Route Monitoring messages) from flush(),
+ * a little at a time, while the queue has room.
+ *
+ * not thread-safe; use it from the thread that owns the BGP sessions and
+ * call flush() whenever fd() is writable and pending().
+ */
+class BGPBmpExporter {
+public:
+    enum { DEFAULT_QUEUE = 4 * 1024 * 1024 };
+
+    BGPBmpExporter(size_t queue_size);
+    ~BGPBmpExporter();
+
+    bool connectUnix(const char *path);
+    bool connectTcp(const char *address, uint16_t port); // IPv4 address
+    void attach(int fd); // takes ownership, made non-blocking
+    void disconnect();
+
+    /* called from flush() once the queue drained after an overflow or a
+     * reconnect. send a bit of the table (after an Initiation and Peer Ups
+     * when restart is set) and return true while there is more to send.
+     * restart is set on the first call of every resync.
+     */
+    void setResync(const std::function<bool (BGPBmpExporter &, bool restart)> &step);
+
+    // false if the message was dropped.
+    bool initiation(const char *sys_name, const char *sys_descr);
+    bool termination(uint16_t reason);
+    bool routeMonitoring(const BGPBmpPeer &peer, const uint8_t *update, size_t length);
+    bool peerUp(const BGPBmpPeer &peer, uint32_t local_address, uint16_t local_port, uint16_t remote_port,
+        const uint8_t *sent_open, size_t sent_length, const uint8_t *received_open, size_t received_length);
+    bool peerDown(const BGPBmpPeer &peer, uint8_t reason, const uint8_t *data, size_t length);
+    bool statsReport(const BGPBmpPeer &peer, const BGPParseContext &counters, uint64_t adj_rib_in_routes, uint64_t loc_rib_routes);
+
+    // write what the socket takes, then run the resync step if due.
+    bool flush();
+
+    int fd() const;
+    bool pending() const;
+    uint64_t drops() const;
+    uint64_t sent() const;
+    bool resyncing() const;
+
+private:
+    enum { NORMAL, DRAINING, RESYNC };
+
+    BGPBmpExporter(const BGPBmpExporter &) = delete;
+    BGPBmpExporter& operator= (const BGPBmpExporter &) = delete;
+
+    bool send(uint8_t type, const BGPBmpPeer *peer, struct iovec *body, int body_count);
+    bool writeQueue();
+    void enqueue(const uint8_t *data, size_t length);
+    void broken();
+
+    int sock;
+    int state;
+    std::vector<uint8_t> queue;
+    size_t head;
+    size_t used;
+    uint64_t dropped;
+    uint64_t messages;
+    bool restart;
+    std::function<bool (BGPBmpExporter &, bool restart)> resync;
+};
+
+}
+
+#endif // LIBBGP_BMP_H
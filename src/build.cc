@@ -49,7 +49,7 @@ int buildOpenMessage(uint8_t *buffer, const BGPPacket &source) {
     auto &parms = msg.opt_parms;
     if (parms.size()) std::for_each(parms.begin(), parms.end(), [&parm_len, &buffer](BGPOptionalParameter param) {
         parm_len += putValue<uint8_t> (&buffer, param.type);
-        parm_len += putValue<uint8_t> (&buffer, param.length);
+        parm_len += putValue<uint8_t> (&buffer, 0); // param.length, from what is written below
         /*if (param->value) {
             memcpy(buffer, param->value, param->length);
             buffer += param->length;
@@ -73,6 +73,23 @@ int buildOpenMessage(uint8_t *buffer, const BGPPacket &source) {
                         caps_len += putValue<uint32_t> (&buffer, htonl(cap.my_asn));
                         break;
                     };
+                    case 64: {
+                        bool ipv4 = cap.afi == 1 && cap.safi == 1;
+                        caps_len += putValue<uint8_t> (&buffer, ipv4 ? 6 : 2);
+                        caps_len += putValue<uint16_t> (&buffer, htons((cap.restart_flags << 12) | (cap.restart_time & 0x0fff)));
+                        if (!ipv4) break;
+                        caps_len += putValue<uint16_t> (&buffer, htons(cap.afi));
+                        caps_len += putValue<uint8_t> (&buffer, cap.safi);
+                        caps_len += putValue<uint8_t> (&buffer, cap.af_flags);
+                        break;
+                    };
+                    case 69: {
+                        caps_len += putValue<uint8_t> (&buffer, 4);
+                        caps_len += putValue<uint16_t> (&buffer, htons(cap.afi));
+                        caps_len += putValue<uint8_t> (&buffer, cap.safi);
+                        caps_len += putValue<uint8_t> (&buffer, cap.send_receive);
+                        break;
+                    };
                     default: break;
                 }
             });
@@ -91,11 +108,19 @@ int buildUpdateMessage(uint8_t *buffer, const BGPPacket &source) {
     int this_len = 0;
     auto &msg = source.update;
 
+    if (msg.end_of_rib) {
+        this_len += putValue<uint16_t> (&buffer, htons(0)); // withdrawn_len
+        this_len += putValue<uint16_t> (&buffer, htons(0)); // path_attribute_length
+        return this_len;
+    }
+
     this_len += putValue<uint16_t> (&buffer, htons(0)); // msg->withdrawn_len
     int withdrawn_len = 0;
+    bool add_path = msg.add_path;
     auto &withdrawn_routes = msg.withdrawn_routes;
     if (withdrawn_routes.size()) std::for_each(withdrawn_routes.begin(), withdrawn_routes.end(), 
-    [&withdrawn_len, &buffer](BGPRoute route) {
+    [&withdrawn_len, &buffer, add_path](BGPRoute route) {
+        if (add_path) withdrawn_len += putValue<uint32_t> (&buffer, htonl(route.path_id));
         withdrawn_len += putValue<uint8_t> (&buffer, route.length);
         int prefix_buffer_size = (route.length + 7) / 8;
         memcpy(buffer, &route.prefix, prefix_buffer_size);
@@ -110,74 +135,19 @@ int buildUpdateMessage(uint8_t *buffer, const BGPPacket &source) {
     this_len += putValue<uint16_t> (&buffer, htons(0)); // msg->path_attribute_length
     int attrs_len = 0;
     auto &attrs = msg.path_attribute;
-    if (attrs.size()) std::for_each(attrs.begin(), attrs.end(), [&attrs_len, &buffer](BGPPathAttribute attr) {
-        uint8_t flags = 0;
-        flags |= (attr.optional << 7) | (attr.transitive << 6)| (attr.partial << 5) | (attr.extened << 4);
-        attrs_len += putValue<uint8_t> (&buffer, flags);
-        attrs_len += putValue<uint8_t> (&buffer, attr.type);
-
-        if (attr.extened) attrs_len += putValue<uint16_t> (&buffer, htons(0));
-        else attrs_len += putValue<uint8_t> (&buffer, 0);
-
-        int attr_len = 0;
-        switch (attr.type) {
-            case 1:  // ORIGIN
-                attr_len += putValue<uint8_t> (&buffer, attr.origin); 
-                break;
-            case 2: { // AS_PATH
-                auto as_path = attr.as_path;
-                auto path = as_path.path;
-                attr_len += putValue<uint8_t> (&buffer, as_path.type);
-                attr_len += putValue<uint8_t> (&buffer, path.size());
-                
-                for (unsigned int i = 0; i < path.size(); i++)
-                    if (attr.peer_as4_ok) attr_len += putValue<uint16_t> (&buffer, htons(path.at(i)));
-                    else attr_len += putValue<uint32_t> (&buffer, htonl(path.at(i)));
-                break;
-            }
-            case 3: // NEXTHOP
-                attr_len += putValue<uint32_t> (&buffer, attr.next_hop); 
-                break;
-            case 4: // MED
-                attr_len += putValue<uint32_t> (&buffer, attr.med); 
-                break;
-            case 5: // L_PREF
-                attr_len += putValue<uint32_t> (&buffer, attr.local_pref); 
-                break;
-            case 6: // AA
-                break;
-            case 7: // AGGR
-                attr_len += putValue<uint16_t> (&buffer, htons(attr.aggregator_asn));
-                attr_len += putValue<uint32_t> (&buffer, attr.aggregator);
-                break;
-            case 17: { // AS4_PATH
-                auto as_path = attr.as4_path;
-                auto path = as_path.path;
-                attr_len += putValue<uint8_t> (&buffer, as_path.type);
-                attr_len += putValue<uint8_t> (&buffer, path.size());
-                
-                for (unsigned int i = 0; i < path.size(); i++)
-                    attr_len += putValue<uint32_t> (&buffer, htonl(path.at(i)));
-                break;
-            }
-            case 18: // AGGR4
-                attr_len += putValue<uint32_t> (&buffer, htonl(attr.aggregator_asn));
-                attr_len += putValue<uint32_t> (&buffer, attr.aggregator);
-                break;
-            default: return 0;
-        } // attr->type switch
-
-        memcpy(buffer - attr_len - 1, &attr_len, sizeof(uint8_t));
-        attrs_len += attr_len;
-        return 0;
-    }); // attr foreach
+    for (auto &attr : attrs) {
+        int written = buildPathAttribute(buffer, attr);
+        buffer += written;
+        attrs_len += written;
+    }
 
     this_len += attrs_len;
     uint16_t attrs_len_n = htons(attrs_len);
     memcpy(buffer - attrs_len - 2, &attrs_len_n, sizeof(uint16_t));
 
     auto &nlri = msg.nlri;
-    if (nlri.size()) std::for_each(nlri.begin(), nlri.end(), [&this_len, &buffer](BGPRoute route) {
+    if (nlri.size()) std::for_each(nlri.begin(), nlri.end(), [&this_len, &buffer, add_path](BGPRoute route) {
+        if (add_path) this_len += putValue<uint32_t> (&buffer, htonl(route.path_id));
         this_len += putValue<uint8_t> (&buffer, route.length);
         int prefix_buffer_size = (route.length + 7) / 8;
         memcpy(buffer, &route.prefix, prefix_buffer_size);
@@ -188,8 +158,41 @@ int buildUpdateMessage(uint8_t *buffer, const BGPPacket &source) {
     return this_len;
 }
 
+int buildPathAttribute(uint8_t *buffer, const BGPPathAttribute &attr) {
+    int this_len = 0;
+    auto &handler = BGPAttributeRegistry::handler(attr.type);
+    size_t attr_len = handler.size(attr);
+    bool extended = attr.extened || attr_len > 255;
+
+    uint8_t flags = 0;
+    flags |= (attr.optional << 7) | (attr.transitive << 6)| (attr.partial << 5) | (extended << 4);
+    this_len += putValue<uint8_t> (&buffer, flags);
+    this_len += putValue<uint8_t> (&buffer, attr.type);
+
+    if (extended) this_len += putValue<uint16_t> (&buffer, htons(attr_len));
+    else this_len += putValue<uint8_t> (&buffer, attr_len);
+
+    return this_len + handler.encode(attr, buffer);
+}
+
+size_t sizeOfPathAttribute(const BGPPathAttribute &attr) {
+    size_t attr_len = BGPAttributeRegistry::handler(attr.type).size(attr);
+    return (attr.extened || attr_len > 255 ? 4 : 3) + attr_len;
+}
+
 int buildNofiticationMessage(uint8_t *buffer, const BGPPacket &source) {
-    return 0;
+    int this_len = 0;
+    auto &msg = source.notification;
+
+    this_len += putValue<uint8_t> (&buffer, msg.error_code);
+    this_len += putValue<uint8_t> (&buffer, msg.error_subcode);
+
+    if (msg.data.size()) {
+        memcpy(buffer, msg.data.data(), msg.data.size());
+        this_len += msg.data.size();
+    }
+
+    return this_len;
 }
 
 } // Builders
@@ -0,0 +1,200 @@
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <set>
+#include <unordered_map>
+#include "community.h"
+
+namespace LibBGP {
+
+bool BGPLargeCommunity::operator< (const BGPLargeCommunity &other) const {
+    if (this->global != other.global) return this->global < other.global;
+    if (this->local1 != other.local1) return this->local1 < other.local1;
+    return this->local2 < other.local2;
+}
+
+bool BGPLargeCommunity::operator== (const BGPLargeCommunity &other) const {
+    return this->global == other.global && this->local1 == other.local1 && this->local2 == other.local2;
+}
+
+void removeRepeats(std::vector<BGPLargeCommunity> &values) {
+    std::vector<BGPLargeCommunity> sorted(values);
+    std::sort(sorted.begin(), sorted.end());
+    if (std::adjacent_find(sorted.begin(), sorted.end()) == sorted.end()) return;
+
+    std::set<BGPLargeCommunity> seen;
+    values.erase(std::remove_if(values.begin(), values.end(), [&seen](const BGPLargeCommunity &value) {
+        return !seen.insert(value).second;
+    }), values.end());
+}
+
+/* node header. the values follow it in the same allocation as they came,
+ * then sorted and de-duplicated, for has().
+ */
+template <typename T> struct BGPCommunityList<T>::Node {
+    std::atomic<uint32_t> refs;
+    uint32_t count;
+    uint32_t distinct;
+    uint64_t hash;
+
+    T* values() { return reinterpret_cast<T*>(this + 1); }
+    T* sorted() { return this->values() + this->count; }
+};
+
+namespace {
+
+template <typename T> struct Store {
+    typedef typename BGPCommunityList<T>::Node Node;
+    std::mutex lock;
+    std::unordered_multimap<uint64_t, Node*> nodes;
+};
+
+template <typename T> Store<T>& store() {
+    static Store<T> s;
+    return s;
+}
+
+uint64_t hashBytes(const void *data, size_t len) {
+    auto *p = (const uint8_t *) data;
+    uint64_t h = 0xcbf29ce484222325ULL; // fnv-1a
+    for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+template <typename T> void acquire(typename BGPCommunityList<T>::Node *node) {
+    if (node) node->refs.fetch_add(1);
+}
+
+/* the count only drops to zero with the store locked, so a concurrent intern
+ * either finds the node alive or not at all.
+ */
+template <typename T> void release(typename BGPCommunityList<T>::Node *node) {
+    if (!node) return;
+
+    uint32_t refs = node->refs.load();
+    while (refs > 1)
+        if (node->refs.compare_exchange_weak(refs, refs - 1)) return;
+
+    auto &s = store<T>();
+    std::lock_guard<std::mutex> guard(s.lock);
+    if (node->refs.fetch_sub(1) != 1) return;
+
+    auto range = s.nodes.equal_range(node->hash);
+    for (auto it = range.first; it != range.second; it++) {
+        if (it->second != node) continue;
+        s.nodes.erase(it);
+        break;
+    }
+
+    node->~Node();
+    free(node);
+}
+
+}
+
+template <typename T> BGPCommunityList<T>::BGPCommunityList() {
+    this->node = NULL;
+}
+
+template <typename T> BGPCommunityList<T>::BGPCommunityList(const BGPCommunityList &other) {
+    this->node = other.node;
+    acquire<T>(this->node);
+}
+
+template <typename T> BGPCommunityList<T>& BGPCommunityList<T>::operator= (const BGPCommunityList &other) {
+    if (this->node == other.node) return *this;
+    acquire<T>(other.node);
+    release<T>(this->node);
+    this->node = other.node;
+    return *this;
+}
+
+template <typename T> BGPCommunityList<T>::~BGPCommunityList() {
+    release<T>(this->node);
+}
+
+template <typename T> BGPCommunityList<T> BGPCommunityList<T>::intern(const T *values, size_t count) {
+    BGPCommunityList list;
+    if (!count) return list;
+
+    size_t bytes = count * sizeof(T);
+    uint64_t hash = hashBytes(values, bytes);
+
+    auto &s = store<T>();
+    std::lock_guard<std::mutex> guard(s.lock);
+
+    auto range = s.nodes.equal_range(hash);
+    for (auto it = range.first; it != range.second; it++) {
+        auto *n = it->second;
+        if (n->count != count || memcmp(n->values(), values, bytes) != 0) continue;
+        n->refs.fetch_add(1);
+        list.node = n;
+        return list;
+    }
+
+    std::vector<T> sorted(values, values + count);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    void *mem = malloc(sizeof(Node) + bytes + sorted.size() * sizeof(T));
+    if (!mem) return list;
+    auto *n = new (mem) Node;
+    n->refs = 1;
+    n->count = count;
+    n->distinct = sorted.size();
+    n->hash = hash;
+    memcpy(n->values(), values, bytes);
+    memcpy(n->sorted(), sorted.data(), sorted.size() * sizeof(T));
+    s.nodes.insert(std::make_pair(hash, n));
+
+    list.node = n;
+    return list;
+}
+
+template <typename T> BGPCommunityList<T> BGPCommunityList<T>::intern(const std::vector<T> &values) {
+    return intern(values.data(), values.size());
+}
+
+template <typename T> size_t BGPCommunityList<T>::size() const {
+    return this->node ? this->node->count : 0;
+}
+
+template <typename T> const T* BGPCommunityList<T>::begin() const {
+    return this->node ? this->node->values() : NULL;
+}
+
+template <typename T> const T* BGPCommunityList<T>::end() const {
+    return this->node ? this->node->values() + this->node->count : NULL;
+}
+
+template <typename T> bool BGPCommunityList<T>::has(const T &value) const {
+    if (!this->node) return false;
+
+    // branch-free lower bound, the loop only depends on the list length.
+    const T *base = this->node->sorted(), *end = base + this->node->distinct;
+    size_t n = this->node->distinct;
+    while (n > 1) {
+        size_t half = n / 2;
+        base = (base[half] < value) ? base + half : base;
+        n -= half;
+    }
+
+    base += *base < value;
+    return base != end && *base == value;
+}
+
+template <typename T> size_t BGPCommunityList<T>::internedCount() {
+    auto &s = store<T>();
+    std::lock_guard<std::mutex> guard(s.lock);
+    return s.nodes.size();
+}
+
+template class BGPCommunityList<uint32_t>;
+template class BGPCommunityList<uint64_t>;
+template class BGPCommunityList<BGPLargeCommunity>;
+
+}
@@ -0,0 +1,64 @@
+#ifndef LIBBGP_COMMUNITY_H
+#define LIBBGP_COMMUNITY_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace LibBGP {
+
+typedef struct BGPLargeCommunity {
+    uint32_t global;
+    uint32_t local1;
+    uint32_t local2;
+
+    bool operator< (const BGPLargeCommunity &other) const;
+    bool operator== (const BGPLargeCommunity &other) const;
+} BGPLargeCommunity;
+
+/* handle to an interned, immutable list of communities, kept in the order
+ * and with the repeats they came with, so they go back on the wire as they
+ * were received. equal lists share one copy no matter how many routes carry
+ * them, so copying a handle is a reference count and comparing two is a
+ * pointer compare. instantiated for uint32_t (COMMUNITIES), uint64_t
+ * (EXTENDED_COMMUNITIES) and BGPLargeCommunity (LARGE_COMMUNITY).
+ */
+template <typename T> class BGPCommunityList {
+public:
+    BGPCommunityList();
+    BGPCommunityList(const BGPCommunityList &other);
+    BGPCommunityList& operator= (const BGPCommunityList &other);
+    ~BGPCommunityList();
+
+    // the shared copy of values, in their order. a sorted copy without
+    // repeats is kept next to it for has().
+    static BGPCommunityList intern(const T *values, size_t count);
+    static BGPCommunityList intern(const std::vector<T> &values);
+
+    size_t size() const; // repeats included
+    const T* begin() const;
+    const T* end() const;
+    bool has(const T &value) const;
+
+    bool operator== (const BGPCommunityList &other) const { return this->node == other.node; }
+    bool operator!= (const BGPCommunityList &other) const { return this->node != other.node; }
+
+    // number of distinct lists currently interned.
+    static size_t internedCount();
+
+    struct Node;
+
+private:
+    Node *node;
+};
+
+// RFC 8092 5: a large community repeated in a list is dropped, the first one kept.
+void removeRepeats(std::vector<BGPLargeCommunity> &values);
+
+typedef BGPCommunityList<uint32_t> BGPCommunities;
+typedef BGPCommunityList<uint64_t> BGPExtCommunities;
+typedef BGPCommunityList<BGPLargeCommunity> BGPLargeCommunities;
+
+}
+
+#endif // LIBBGP_COMMUNITY_H
@@ -0,0 +1,130 @@
+#include <stdint.h>
+#include <math.h>
+#include "damping.h"
+
+namespace LibBGP {
+
+BGPDampingConfig::BGPDampingConfig() {
+    this->half_life = 900;
+    this->reuse = 750;
+    this->suppress = 2000;
+    this->max_suppress = 3600;
+    this->withdraw_penalty = 1000;
+    this->attribute_change_penalty = 500;
+}
+
+BGPDamping::BGPDamping(const BGPDampingConfig &config, uint64_t now) : config(config), wheel(now) {
+    if (!this->config.half_life) this->config.half_life = 1;
+
+    // RFC 2439 4.2: a penalty above this could not decay to reuse within max_suppress.
+    this->ceiling = this->config.reuse * exp2((double) this->config.max_suppress / this->config.half_life);
+}
+
+uint64_t BGPDamping::key(const BGPRoute &route) {
+    return (uint64_t) route.prefix << 8 | route.length;
+}
+
+BGPRoute BGPDamping::route(uint64_t key) {
+    BGPRoute route;
+    route.prefix = key >> 8;
+    route.length = key & 0xff;
+    route.path_id = 0;
+    return route;
+}
+
+double BGPDamping::decayed(const State &state, uint64_t now) const {
+    if (now <= state.updated) return state.penalty;
+    return state.penalty * exp2(-(double) (now - state.updated) / this->config.half_life);
+}
+
+/* the next thing that can happen to a prefix without another flap: reuse if
+ * it is suppressed, otherwise its state being freed.
+ */
+void BGPDamping::reschedule(State &state, uint64_t now) {
+    double target = state.suppressed ? this->config.reuse : this->config.reuse / 2.0;
+    double wait = state.penalty > target ? this->config.half_life * log2(state.penalty / target) : 0;
+    uint64_t at = state.updated + (uint64_t) ceil(wait);
+
+    if (state.suppressed && at > state.suppressed_at + this->config.max_suppress)
+        at = state.suppressed_at + this->config.max_suppress;
+
+    this->wheel.schedule(&state, at > now ? at : now);
+}
+
+bool BGPDamping::flap(const BGPRoute &route, uint64_t now, uint32_t penalty) {
+    auto &state = this->states[key(route)]; // only flapping prefixes get here
+    if (!state.key) {
+        state.key = key(route) | (1ULL << 63); // never 0, even for 0.0.0.0/0
+        state.penalty = 0;
+        state.updated = now;
+        state.suppressed = false;
+    }
+
+    state.penalty = this->decayed(state, now) + penalty;
+    if (state.penalty > this->ceiling) state.penalty = this->ceiling;
+    state.updated = now;
+
+    if (!state.suppressed && state.penalty >= this->config.suppress) {
+        state.suppressed = true;
+        state.suppressed_at = now;
+    }
+
+    this->reschedule(state, now);
+    return state.suppressed;
+}
+
+bool BGPDamping::withdrawn(const BGPRoute &route, uint64_t now) {
+    return this->flap(route, now, this->config.withdraw_penalty);
+}
+
+bool BGPDamping::attributeChanged(const BGPRoute &route, uint64_t now) {
+    return this->flap(route, now, this->config.attribute_change_penalty);
+}
+
+bool BGPDamping::suppressed(const BGPRoute &route) const {
+    auto it = this->states.find(key(route));
+    return it != this->states.end() && it->second.suppressed;
+}
+
+uint32_t BGPDamping::penalty(const BGPRoute &route, uint64_t now) const {
+    auto it = this->states.find(key(route));
+    return it == this->states.end() ? 0 : (uint32_t) this->decayed(it->second, now);
+}
+
+void BGPDamping::advance(uint64_t now, const std::function<void (const BGPRoute &)> &reuse) {
+    this->wheel.advance(now, [this, &reuse](BGPTimer *timer) {
+        auto &state = *static_cast<State *>(timer);
+        uint64_t at = this->wheel.now();
+
+        state.penalty = this->decayed(state, at);
+        state.updated = at;
+
+        if (state.suppressed) {
+            if (state.penalty >= this->config.reuse && at < state.suppressed_at + this->config.max_suppress) {
+                this->reschedule(state, at);
+                return;
+            }
+            state.suppressed = false;
+            reuse(route(state.key & ~(1ULL << 63)));
+            this->reschedule(state, at);
+            return;
+        }
+
+        if (state.penalty >= this->config.reuse / 2.0) {
+            this->reschedule(state, at);
+            return;
+        }
+
+        this->states.erase(state.key & ~(1ULL << 63));
+    });
+}
+
+size_t BGPDamping::size() const {
+    return this->states.size();
+}
+
+uint64_t BGPDamping::now() const {
+    return this->wheel.now();
+}
+
+}
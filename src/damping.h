@@ -0,0 +1,78 @@
+#ifndef LIBBGP_DAMPING_H
+#define LIBBGP_DAMPING_H
+
+#include <stdint.h>
+#include <functional>
+#include <unordered_map>
+#include "libbgp.h"
+#include "timer_wheel.h"
+
+namespace LibBGP {
+
+typedef struct BGPDampingConfig {
+    uint32_t half_life; // seconds
+    uint32_t reuse;
+    uint32_t suppress;
+    uint32_t max_suppress; // seconds
+    uint32_t withdraw_penalty;
+    uint32_t attribute_change_penalty;
+
+    BGPDampingConfig(); // RFC 2439 / common defaults: 900, 750, 2000, 3600, 1000, 500
+} BGPDampingConfig;
+
+/* RFC 2439 route flap damping, per prefix. state only exists for prefixes
+ * that have flapped and is dropped once the penalty has decayed below half
+ * the reuse threshold. penalties are decayed lazily, and the only scheduled
+ * work (reuse of a suppressed prefix, freeing a decayed one) runs on a
+ * timing wheel with one tick per second, so there are no periodic scans.
+ *
+ * times are in seconds from any monotonic clock.
+ *
+ * the table only keeps score. BGPRib::setDamping() has a RIB record a
+ * peer's flaps and leave its suppressed paths out of best-path; without
+ * that, callers have to leave out suppressed routes themselves.
+ */
+class BGPDamping {
+public:
+    BGPDamping(const BGPDampingConfig &config, uint64_t now);
+
+    // record a flap, returns true if route is suppressed after it.
+    bool withdrawn(const BGPRoute &route, uint64_t now);
+    bool attributeChanged(const BGPRoute &route, uint64_t now);
+
+    bool suppressed(const BGPRoute &route) const;
+    uint32_t penalty(const BGPRoute &route, uint64_t now) const;
+
+    // run due events, reuse is called for every route no longer suppressed.
+    void advance(uint64_t now, const std::function<void (const BGPRoute &)> &reuse);
+
+    // prefixes with damping state.
+    size_t size() const;
+
+    uint64_t now() const; // as of the last advance()
+
+private:
+    typedef struct State : BGPTimer {
+        uint64_t key;
+        double penalty; // as of updated
+        uint64_t updated;
+        uint64_t suppressed_at;
+        bool suppressed;
+    } State;
+
+    bool flap(const BGPRoute &route, uint64_t now, uint32_t penalty);
+    double decayed(const State &state, uint64_t now) const;
+    void reschedule(State &state, uint64_t now);
+
+    static uint64_t key(const BGPRoute &route);
+    static BGPRoute route(uint64_t key);
+
+    BGPDampingConfig config;
+    double ceiling;
+    std::unordered_map<uint64_t, State> states;
+    BGPTimerWheel wheel;
+};
+
+}
+
+#endif // LIBBGP_DAMPING_H
@@ -0,0 +1,98 @@
+#ifndef LIBBGP_INLINE_VECTOR_H
+#define LIBBGP_INLINE_VECTOR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace LibBGP {
+
+/* vector keeping up to N elements in itself, and only going to the heap
+ * past that. for the per-prefix path lists, which are short: one or two
+ * paths in a node take no allocation of their own.
+ */
+template <typename T, size_t N> class BGPInlineVector {
+public:
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    BGPInlineVector() {
+        this->count = 0;
+        this->capacity = N;
+        this->heap = NULL;
+    }
+
+    BGPInlineVector(const BGPInlineVector &other) {
+        this->count = 0;
+        this->capacity = N;
+        this->heap = NULL;
+        this->reserve(other.count);
+        for (auto &item : other) new (this->data() + this->count++) T(item);
+    }
+
+    BGPInlineVector& operator= (const BGPInlineVector &other) {
+        if (this == &other) return *this;
+        this->clear();
+        this->reserve(other.count);
+        for (auto &item : other) new (this->data() + this->count++) T(item);
+        return *this;
+    }
+
+    ~BGPInlineVector() {
+        this->clear();
+        free(this->heap);
+    }
+
+    T* begin() { return this->data(); }
+    T* end() { return this->data() + this->count; }
+    const T* begin() const { return this->data(); }
+    const T* end() const { return this->data() + this->count; }
+
+    size_t size() const { return this->count; }
+    bool empty() const { return !this->count; }
+    T& operator[] (size_t i) { return this->data()[i]; }
+    const T& operator[] (size_t i) const { return this->data()[i]; }
+
+    void push_back(const T &item) {
+        if (this->count == this->capacity) this->reserve(this->capacity * 2);
+        new (this->data() + this->count++) T(item);
+    }
+
+    T* erase(T *at) {
+        for (T *next = at + 1; next != this->end(); next++) *(next - 1) = std::move(*next);
+        this->data()[--this->count].~T();
+        return at;
+    }
+
+    void clear() {
+        for (auto &item : *this) item.~T();
+        this->count = 0;
+    }
+
+    void reserve(size_t capacity) {
+        if (capacity <= this->capacity) return;
+        T *moved = (T *) malloc(capacity * sizeof(T));
+        for (uint32_t i = 0; i < this->count; i++) {
+            new (moved + i) T(std::move(this->data()[i]));
+            this->data()[i].~T();
+        }
+        free(this->heap);
+        this->heap = moved;
+        this->capacity = capacity;
+    }
+
+private:
+    T* data() { return this->heap ? this->heap : (T *) this->local; }
+    const T* data() const { return this->heap ? this->heap : (const T *) this->local; }
+
+    uint32_t count;
+    uint32_t capacity;
+    T *heap;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type local[N];
+};
+
+}
+
+#endif // LIBBGP_INLINE_VECTOR_H
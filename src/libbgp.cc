@@ -4,19 +4,28 @@
 #include <stdlib.h>
 #include <algorithm>
 #include "libbgp.h"
+#include "policy.h"
 #include <stdio.h>
 
 namespace LibBGP {
 
-BGPPacket::BGPPacket() {
-    memset(this, 0, sizeof(BGPPacket));
+BGPPacket::BGPPacket() : length(0), type(0), open(), update(), notification(), context(NULL) {
 }
 
-BGPPacket::BGPPacket(uint8_t *buffer) {
-    memset(this, 0, sizeof(BGPPacket));
+BGPPacket::BGPPacket(uint8_t *buffer) : length(0), type(0), open(), update(), notification(), context(NULL) {
     this->read(buffer);
 }
 
+BGPPacket::BGPPacket(uint8_t *buffer, BGPParseContext *context) : length(0), type(0), open(), update(), notification(), context(context) {
+    this->read(buffer);
+    if (this->type == 2) this->update.trace.stage(BGP_TRACE_PARSE);
+}
+
+BGPParseContext::BGPParseContext() {
+    memset(this, 0, sizeof(BGPParseContext));
+    this->as4 = true;
+}
+
 int BGPPacket::write(uint8_t *buffer) {
     return Build(buffer, *this);
 }
@@ -25,20 +34,30 @@ uint8_t* BGPPacket::read(uint8_t *buffer) {
     return Parse(buffer, this);
 }
 
-BGPOpenMessage::BGPOpenMessage() {
-    memset(this, 0, sizeof(BGPOpenMessage));
+BGPOpenMessage::BGPOpenMessage() : version(0), my_asn(0), hold_time(0), bgp_id(0), opt_parm_len(0), opt_parms() {
 }
 
-BGPOpenMessage::BGPOpenMessage(uint32_t my_asn, uint16_t hold_time, uint32_t bgp_id) {
-    memset(this, 0, sizeof(BGPOpenMessage));
+BGPOpenMessage::BGPOpenMessage(uint32_t my_asn, uint16_t hold_time, uint32_t bgp_id) : BGPOpenMessage() {
     this->version = 4;
     this->set4BAsn(my_asn);
     this->hold_time = hold_time;
     this->bgp_id = bgp_id;
 }
 
-BGPPathAttribute::BGPPathAttribute() {
-    memset(this, 0, sizeof(BGPPathAttribute));
+BGPPathAttribute::BGPPathAttribute() : optional(false), transitive(false), partial(false), extened(false),
+    peer_as4_ok(false), type(0), length(0), origin(0), as_path(), as4_path(), next_hop(0), med(0), local_pref(0),
+    atomic_aggregate(false), aggregator_asn(0), aggregator(0), aggregator_asn4(0), communities(),
+    ext_communities(), large_communities(), value() {
+}
+
+BGPNotificationMessage::BGPNotificationMessage() {
+    this->error_code = 0;
+    this->error_subcode = 0;
+}
+
+BGPNotificationMessage::BGPNotificationMessage(uint8_t error_code, uint8_t error_subcode) {
+    this->error_code = error_code;
+    this->error_subcode = error_subcode;
 }
 
 BGPCapability::BGPCapability() {
@@ -84,6 +103,114 @@ void BGPOpenMessage::remove4BAsn() {
     });
 }
 
+void BGPOpenMessage::setAddPath(uint8_t send_receive) {
+    auto &params = this->opt_parms;
+    for (auto &param : params) {
+        if (param.type != 2) continue;
+        auto &caps = param.capabilities;
+        caps.erase(std::remove_if(caps.begin(), caps.end(), [](const BGPCapability &cap) {
+            return cap.code == 69;
+        }), caps.end());
+    }
+
+    params.erase(std::remove_if(params.begin(), params.end(), [](const BGPOptionalParameter &param) {
+        return param.type == 2 && !param.capabilities.size();
+    }), params.end());
+
+    if (send_receive == BGP_ADD_PATH_NONE) return;
+
+    BGPOptionalParameter param;
+    BGPCapability capa;
+
+    param.type = 2;
+    param.length = 6;
+
+    capa.code = 69;
+    capa.length = 4;
+    capa.afi = 1; // IPv4
+    capa.safi = 1; // unicast
+    capa.send_receive = send_receive;
+
+    param.capabilities.push_back(capa);
+    this->opt_parms.push_back(param);
+}
+
+uint8_t BGPOpenMessage::getAddPath() const {
+    for (auto &param : this->opt_parms) {
+        if (param.type != 2) continue;
+        for (auto &cap : param.capabilities)
+            if (cap.code == 69 && cap.afi == 1 && cap.safi == 1) return cap.send_receive;
+    }
+
+    return BGP_ADD_PATH_NONE;
+}
+
+uint8_t BGPOpenMessage::negotiateAddPath(const BGPOpenMessage &peer) const {
+    uint8_t ours = this->getAddPath(), theirs = peer.getAddPath(), mode = BGP_ADD_PATH_NONE;
+    if ((ours & BGP_ADD_PATH_RECEIVE) && (theirs & BGP_ADD_PATH_SEND)) mode |= BGP_ADD_PATH_RECEIVE;
+    if ((ours & BGP_ADD_PATH_SEND) && (theirs & BGP_ADD_PATH_RECEIVE)) mode |= BGP_ADD_PATH_SEND;
+    return mode;
+}
+
+void BGPOpenMessage::setGracefulRestart(uint16_t restart_time, bool restarting, bool forwarding) {
+    this->removeGracefulRestart();
+
+    BGPOptionalParameter param;
+    BGPCapability capa;
+
+    param.type = 2;
+    param.length = 8;
+
+    capa.code = 64;
+    capa.length = 6;
+    capa.restart_flags = restarting ? 0x8 : 0;
+    capa.restart_time = restart_time & 0x0fff;
+    capa.afi = 1; // IPv4
+    capa.safi = 1; // unicast
+    capa.af_flags = forwarding ? 0x80 : 0;
+
+    param.capabilities.push_back(capa);
+    this->opt_parms.push_back(param);
+}
+
+void BGPOpenMessage::removeGracefulRestart() {
+    auto &params = this->opt_parms;
+    for (auto &param : params) {
+        if (param.type != 2) continue;
+        auto &caps = param.capabilities;
+        caps.erase(std::remove_if(caps.begin(), caps.end(), [](const BGPCapability &cap) {
+            return cap.code == 64;
+        }), caps.end());
+    }
+
+    params.erase(std::remove_if(params.begin(), params.end(), [](const BGPOptionalParameter &param) {
+        return param.type == 2 && !param.capabilities.size();
+    }), params.end());
+}
+
+const BGPCapability* BGPOpenMessage::getGracefulRestart() const {
+    for (auto &param : this->opt_parms) {
+        if (param.type != 2) continue;
+        for (auto &cap : param.capabilities)
+            if (cap.code == 64) return &cap;
+    }
+
+    return NULL;
+}
+
+bool BGPOpenMessage::negotiateAs4(const BGPOpenMessage &peer) const {
+    auto has = [](const BGPOpenMessage &open) {
+        for (auto &param : open.opt_parms) {
+            if (param.type != 2) continue;
+            for (auto &cap : param.capabilities)
+                if (cap.code == 65) return true;
+        }
+        return false;
+    };
+
+    return has(*this) && has(peer);
+}
+
 uint32_t BGPOpenMessage::getAsn() {
     if (!this->opt_parms.size()) return this->my_asn;
     auto &params = this->opt_parms;
@@ -104,7 +231,7 @@ uint32_t BGPOpenMessage::getAsn() {
 BGPPathAttribute* BGPUpdateMessage::getAttrib(uint8_t attrib_type) {
     if (!this->path_attribute.size()) return NULL;
     auto &attrs = this->path_attribute;
-    auto attr = std::find_if(attrs.begin(), attrs.end(), [attrib_type](BGPPathAttribute attr) {
+    auto attr = std::find_if(attrs.begin(), attrs.end(), [attrib_type](const BGPPathAttribute &attr) {
         return attr.type == attrib_type;
     });
 
@@ -136,28 +263,27 @@ void BGPUpdateMessage::setNexthop(uint32_t nexthop) {
     }
 }
 
-std::vector<uint32_t>* BGPUpdateMessage::getAsPath() {
-    if (!this->path_attribute.size()) return NULL;
-    auto &attrs = this->path_attribute;
-    auto attr = std::find_if(attrs.begin(), attrs.end(), [](BGPPathAttribute attr) {
-        return attr.type == 17 || attr.type == 2;
-    });
-
-    if (attr == attrs.end()) return NULL;
-    
-    std::vector<uint32_t>* path = NULL;
-    while (attr != attrs.end()) {
-        if ((*attr).type == 17) return & ((*attr).as4_path.path);
-        if ((*attr).type == 2) path = & ((*attr).as_path.path);
-        attr++;
+BGPAsPath* BGPUpdateMessage::getAsPath() {
+    BGPPathAttribute *as_path = NULL, *as4_path = NULL;
+    for (auto &attr : this->path_attribute) {
+        if (attr.type == 2) as_path = &attr;
+        if (attr.type == 17) as4_path = &attr;
     }
 
-    return path; 
+    if (!as4_path) return as_path ? &as_path->as_path.path : NULL;
+    if (!as_path) return &as4_path->as4_path.path;
+
+    // between 4-byte speakers AS4_PATH is not used (RFC 6793 4.1).
+    if (as_path->peer_as4_ok) return &as_path->as_path.path;
+
+    // from a 2-byte speaker; worked out once per unique pair of paths.
+    this->merged_as_path = BGPAsPath::reconstruct(as_path->as_path.path, as4_path->as4_path.path);
+    return &this->merged_as_path;
 }
 
 void BGPUpdateMessage::setAsPath(const std::vector<uint32_t> &path, bool peer_as4_ok) {
     auto &attrs = this->path_attribute;
-    attrs.erase(std::find_if(attrs.begin(), attrs.end(), [](BGPPathAttribute attr) {
+    attrs.erase(std::remove_if(attrs.begin(), attrs.end(), [](const BGPPathAttribute &attr) {
         return attr.type == 17 || attr.type == 2;
     }), attrs.end());
 
@@ -166,10 +292,11 @@ void BGPUpdateMessage::setAsPath(const std::vector<uint32_t> &path, bool peer_as
         BGPASPath n_path;
         n_path.type = 2;
         n_path.length = path.size();
-        n_path.path = path;
+        n_path.path = BGPAsPath::intern(path);
 
         n_attr.type = 2;
         n_attr.transitive = true;
+        n_attr.peer_as4_ok = true;
         n_attr.as_path = n_path;
         attrs.push_back(n_attr);
     } else {
@@ -178,19 +305,23 @@ void BGPUpdateMessage::setAsPath(const std::vector<uint32_t> &path, bool peer_as
         BGPPathAttribute n_attr_as2;
         BGPASPath n_path_as2;
 
-        auto max_as = std::max_element(path.begin(), path.end());
-
-        if (max_as == path.end()) return; // WTF?
+        if (!path.size()) return;
 
-        n_path.type = 17;
+        n_path.type = 2; // AS_SEQUENCE
         n_path.length = path.size();
-        n_path.path = path;
+        n_path.path = BGPAsPath::intern(path);
 
+        n_attr.type = 17;
         n_attr.transitive = true;
         n_attr.optional = true;
+        n_attr.peer_as4_ok = true;
         n_attr.as4_path = n_path;
 
-        n_path_as2.path = (*max_as > 65535) ? std::vector<uint32_t> (path.size(), 23456) : path;
+        n_path_as2.type = 2;
+        n_path_as2.length = path.size();
+        std::vector<uint32_t> path_as2(path);
+        for (auto &asn : path_as2) if (asn > 65535) asn = BGPAsPath::AS_TRANS; // RFC 6793 4.2.2
+        n_path_as2.path = BGPAsPath::intern(path_as2);
 
         n_attr_as2.type = 2;
         n_attr_as2.transitive = true;
@@ -202,6 +333,33 @@ void BGPUpdateMessage::setAsPath(const std::vector<uint32_t> &path, bool peer_as
 
 }
 
+void BGPUpdateMessage::setAggregator(uint32_t asn, uint32_t address, bool as4) {
+    auto &attrs = this->path_attribute;
+    attrs.erase(std::remove_if(attrs.begin(), attrs.end(), [](const BGPPathAttribute &attr) {
+        return attr.type == 18 || attr.type == 7;
+    }), attrs.end());
+
+    BGPPathAttribute n_attr;
+    n_attr.type = 7;
+    n_attr.optional = true;
+    n_attr.transitive = true;
+    n_attr.peer_as4_ok = as4;
+    n_attr.aggregator = address;
+    if (as4) n_attr.aggregator_asn4 = asn;
+    else n_attr.aggregator_asn = asn > 65535 ? (uint16_t) BGPAsPath::AS_TRANS : asn;
+    attrs.push_back(n_attr);
+
+    if (as4 || asn <= 65535) return;
+
+    BGPPathAttribute n_attr_as4;
+    n_attr_as4.type = 18;
+    n_attr_as4.optional = true;
+    n_attr_as4.transitive = true;
+    n_attr_as4.aggregator_asn4 = asn;
+    n_attr_as4.aggregator = address;
+    attrs.push_back(n_attr_as4);
+}
+
 uint8_t BGPUpdateMessage::getOrigin() {
     auto attr = this->getAttrib(1);
     return attr ? attr->origin : 0; // TODO not 0 when not found
@@ -249,17 +407,112 @@ void BGPUpdateMessage::setLocalPref(uint32_t local_pref) {
         BGPPathAttribute n_attr;
         n_attr.type = 5;
         n_attr.local_pref = local_pref;
-        n_attr.optional = true;
+        n_attr.transitive = true; // well-known
         this->addAttrib(n_attr);
     }
 }
 
-void BGPUpdateMessage::addPrefix(uint32_t prefix, uint8_t length, bool is_withdraw) {
+const BGPCommunities* BGPUpdateMessage::getCommunities() {
+    auto attr = this->getAttrib(8);
+    return attr ? &(attr->communities) : NULL;
+}
+
+void BGPUpdateMessage::setCommunities(const std::vector<uint32_t> &communities) {
+    auto attr = this->getAttrib(8);
+    BGPPathAttribute n_attr;
+
+    if (!attr) {
+        n_attr.type = 8;
+        n_attr.optional = true;
+        n_attr.transitive = true;
+        attr = &n_attr;
+    }
+
+    attr->communities = BGPCommunities::intern(communities);
+    attr->length = attr->communities.size() * 4;
+    attr->extened = attr->length > 255;
+
+    if (attr == &n_attr) this->addAttrib(n_attr);
+}
+
+bool BGPUpdateMessage::hasCommunity(uint32_t community) {
+    auto attr = this->getAttrib(8);
+    return attr ? attr->communities.has(community) : false;
+}
+
+const BGPExtCommunities* BGPUpdateMessage::getExtCommunities() {
+    auto attr = this->getAttrib(16);
+    return attr ? &(attr->ext_communities) : NULL;
+}
+
+void BGPUpdateMessage::setExtCommunities(const std::vector<uint64_t> &communities) {
+    auto attr = this->getAttrib(16);
+    BGPPathAttribute n_attr;
+
+    if (!attr) {
+        n_attr.type = 16;
+        n_attr.optional = true;
+        n_attr.transitive = true;
+        attr = &n_attr;
+    }
+
+    attr->ext_communities = BGPExtCommunities::intern(communities);
+    attr->length = attr->ext_communities.size() * 8;
+    attr->extened = attr->length > 255;
+
+    if (attr == &n_attr) this->addAttrib(n_attr);
+}
+
+bool BGPUpdateMessage::hasExtCommunity(uint64_t community) {
+    auto attr = this->getAttrib(16);
+    return attr ? attr->ext_communities.has(community) : false;
+}
+
+const BGPLargeCommunities* BGPUpdateMessage::getLargeCommunities() {
+    auto attr = this->getAttrib(32);
+    return attr ? &(attr->large_communities) : NULL;
+}
+
+void BGPUpdateMessage::setLargeCommunities(const std::vector<BGPLargeCommunity> &communities) {
+    auto attr = this->getAttrib(32);
+    BGPPathAttribute n_attr;
+
+    if (!attr) {
+        n_attr.type = 32;
+        n_attr.optional = true;
+        n_attr.transitive = true;
+        attr = &n_attr;
+    }
+
+    std::vector<BGPLargeCommunity> values(communities);
+    removeRepeats(values);
+    attr->large_communities = BGPLargeCommunities::intern(values);
+    attr->length = attr->large_communities.size() * 12;
+    attr->extened = attr->length > 255;
+
+    if (attr == &n_attr) this->addAttrib(n_attr);
+}
+
+bool BGPUpdateMessage::hasLargeCommunity(const BGPLargeCommunity &community) {
+    auto attr = this->getAttrib(32);
+    return attr ? attr->large_communities.has(community) : false;
+}
+
+void BGPUpdateMessage::addPrefix(uint32_t prefix, uint8_t length, bool is_withdraw, uint32_t path_id) {
     BGPRoute route;
     route.prefix = prefix;
     route.length = length;
+    route.path_id = path_id;
     if (is_withdraw) this->withdrawn_routes.push_back(route);
     else this->nlri.push_back(route);
 }
 
+void BGPUpdateMessage::setError(uint8_t action, uint8_t subcode, uint8_t attrib_type, uint8_t code) {
+    if (action <= this->error_action) return;
+    this->error_action = action;
+    this->error_code = code;
+    this->error_subcode = subcode;
+    this->error_attribute = attrib_type;
+}
+
 }
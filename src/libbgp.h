@@ -5,9 +5,25 @@
 #include <stdlib.h>
 #include <utility>
 #include <vector>
+#include "accounting.h"
+#include "aspath.h"
+#include "attribute.h"
+#include "community.h"
+#include "trace.h"
 
 namespace LibBGP {
 
+class BGPRouteMap;
+class BGPRib;
+
+// ADD-PATH (RFC 7911) send/receive field, from the speaker's side.
+enum BGPAddPathMode {
+    BGP_ADD_PATH_NONE = 0,
+    BGP_ADD_PATH_RECEIVE = 1,
+    BGP_ADD_PATH_SEND = 2,
+    BGP_ADD_PATH_BOTH = 3
+};
+
 typedef struct BGPCapability {
     uint8_t code;
     uint8_t length;
@@ -15,6 +31,18 @@ typedef struct BGPCapability {
     bool as4_support;
     uint32_t my_asn;
 
+    // ADD-PATH, Graceful Restart: the IPv4 unicast entry; entries for other
+    // families are skipped.
+    uint16_t afi;
+    uint8_t safi;
+    uint8_t send_receive;
+
+    // Graceful Restart (RFC 4724): restart flags (R: 0x8) and time in
+    // seconds, 12 bits of it, then the IPv4 unicast entry's flags (F: 0x80).
+    uint8_t restart_flags;
+    uint16_t restart_time;
+    uint8_t af_flags;
+
     BGPCapability();
 } BGPCapability;
 
@@ -40,17 +68,37 @@ typedef struct BGPOpenMessage {
     void set4BAsn(uint32_t my_asn);
     void remove4BAsn();
     uint32_t getAsn();
+
+    void setAddPath(uint8_t send_receive); // BGPAddPathMode, NONE removes it
+    uint8_t getAddPath() const;
+
+    /* what was agreed on between this OPEN (ours) and the peer's: RECEIVE
+     * if the peer will send us path IDs, SEND if we may send it some.
+     */
+    uint8_t negotiateAddPath(const BGPOpenMessage &peer) const;
+
+    // both this OPEN and the peer's have the 4-byte ASN capability (RFC 6793).
+    bool negotiateAs4(const BGPOpenMessage &peer) const;
+
+    /* Graceful Restart for IPv4 unicast. restarting: the R bit, for the OPEN
+     * sent right after our own restart; forwarding: the F bit, we kept
+     * forwarding over it.
+     */
+    void setGracefulRestart(uint16_t restart_time, bool restarting, bool forwarding);
+    void removeGracefulRestart();
+    const BGPCapability* getGracefulRestart() const; // NULL if not there
 } BGPOpenMessage;
 
 typedef struct BGPASPath {
     uint8_t type;
     uint8_t length;
-    std::vector<uint32_t> path;
+    BGPAsPath path; // interned
 } BGPASPath;
 
 typedef struct BGPRoute {
     uint8_t length;
     uint32_t prefix;
+    uint32_t path_id; // ADD-PATH path identifier, 0 without it
 } BGPRoute;
 
 typedef struct BGPPathAttribute {
@@ -58,7 +106,7 @@ typedef struct BGPPathAttribute {
     bool transitive;
     bool partial;
     bool extened;
-    bool peer_as4_ok;
+    bool peer_as4_ok; // AS_PATH, AGGREGATOR: 4-byte ASNs on the wire
     uint8_t type;
     uint16_t length;
 
@@ -72,9 +120,30 @@ typedef struct BGPPathAttribute {
     uint16_t aggregator_asn;
     uint32_t aggregator;
     uint32_t aggregator_asn4;
+    BGPCommunities communities;
+    BGPExtCommunities ext_communities;
+    BGPLargeCommunities large_communities;
+    std::vector<uint8_t> value; // types without a built-in codec, as on the wire
     BGPPathAttribute ();
 } BGPPathAttribute;
 
+/* part of an UPDATE's nlri that a route-map gave other attributes, see
+ * BGPUpdateMessage::nlri_split.
+ */
+typedef struct BGPUpdateSplit {
+    int term; // first route-map term of the group, its set actions applied
+    std::vector<BGPPathAttribute> path_attribute;
+    std::vector<BGPRoute> nlri;
+} BGPUpdateSplit;
+
+/* RFC 7606 error handling, ordered from the mildest to the harshest. */
+enum BGPUpdateErrorAction {
+    BGP_UPDATE_OK = 0,
+    BGP_UPDATE_ATTRIBUTE_DISCARD = 1, // bad attribute dropped, rest of the UPDATE is fine
+    BGP_UPDATE_TREAT_AS_WITHDRAW = 2, // nlri moved to withdrawn_routes
+    BGP_UPDATE_SESSION_RESET = 3 // send NOTIFICATION (error_code, error_subcode)
+};
+
 typedef struct BGPUpdateMessage {
     uint16_t withdrawn_len;
     std::vector<BGPRoute> withdrawn_routes;
@@ -82,6 +151,36 @@ typedef struct BGPUpdateMessage {
     std::vector<BGPPathAttribute> path_attribute;
     std::vector<BGPRoute> nlri;
 
+    /* nlri permitted by a route-map term whose set actions differ from the
+     * ones applied to path_attribute, one group per distinct set of actions,
+     * each with the attributes its actions give.
+     */
+    std::vector<BGPUpdateSplit> nlri_split;
+
+    // prefixes carry a path identifier (RFC 7911). set by the parser from
+    // the context, and by whoever builds an UPDATE for a peer that agreed.
+    bool add_path;
+
+    /* End-of-RIB (RFC 4724 2): an UPDATE with nothing in it. set by the
+     * parser; when set, the builder writes an empty UPDATE, whatever else
+     * is in the message.
+     */
+    bool end_of_rib;
+
+    /* set by the parser. error_code, error_subcode and error_attribute are
+     * from the harshest error seen in this UPDATE. error_code is 3 (UPDATE
+     * Message Error), or 6 (Cease) when the peer went over max-prefix.
+     */
+    uint8_t error_action;
+    uint8_t error_code;
+    uint8_t error_subcode;
+    uint8_t error_attribute;
+
+    // AS_PATH merged with AS4_PATH, filled by getAsPath() when both are there.
+    BGPAsPath merged_as_path;
+
+    BGPTrace trace; // sampled with BGPParseContext::trace, follows the routes
+
     /* a few methods for some common things, so that we don't have to read/make
      * every attribute ourself.
      */
@@ -91,9 +190,15 @@ typedef struct BGPUpdateMessage {
     uint32_t getNexthop();
     void setNexthop(uint32_t nexthop);
 
-    std::vector<uint32_t>* getAsPath();
+    BGPAsPath* getAsPath();
     void setAsPath(const std::vector<uint32_t> &path, bool as4);
 
+    /* AGGREGATOR for a session with (as4) or without 4-byte ASNs. without,
+     * an ASN over 65535 goes as AS_TRANS, with AS4_AGGREGATOR for the real
+     * one (RFC 6793 4.2.2).
+     */
+    void setAggregator(uint32_t asn, uint32_t address, bool as4);
+
     uint8_t getOrigin();
     void setOrigin(uint8_t origin);
 
@@ -103,22 +208,65 @@ typedef struct BGPUpdateMessage {
     uint32_t getLocalPref();
     void setLocalPref(uint32_t local_pref);
 
-    void addPrefix(uint32_t prefix, uint8_t length, bool is_withdraw);
+    const BGPCommunities* getCommunities();
+    void setCommunities(const std::vector<uint32_t> &communities);
+    bool hasCommunity(uint32_t community);
+
+    const BGPExtCommunities* getExtCommunities();
+    void setExtCommunities(const std::vector<uint64_t> &communities);
+    bool hasExtCommunity(uint64_t community);
+
+    const BGPLargeCommunities* getLargeCommunities();
+    void setLargeCommunities(const std::vector<BGPLargeCommunity> &communities);
+    bool hasLargeCommunity(const BGPLargeCommunity &community);
+
+    void addPrefix(uint32_t prefix, uint8_t length, bool is_withdraw, uint32_t path_id = 0);
+
+    void setError(uint8_t action, uint8_t subcode, uint8_t attrib_type, uint8_t code = 3);
 } BGPUpdateMessage;
 
 typedef struct BGPNotificationMessage {
+    uint8_t error_code;
+    uint8_t error_subcode;
+    std::vector<uint8_t> data;
 
+    BGPNotificationMessage();
+    BGPNotificationMessage(uint8_t error_code, uint8_t error_subcode);
 } BGPNotificationMessage;
 
+/* per-peer state the parser uses, if any. */
+typedef struct BGPParseContext {
+    const BGPRouteMap *route_map; // inbound policy, applied while parsing nlri
+    BGPPeerAccounting *accounting; // max-prefix, checked while parsing nlri
+
+    // the RIB the peer's routes go to, if any, and the peer there. lets an
+    // UPDATE over max-prefix by count alone have its re-announced and
+    // withdrawn prefixes credited before the session is reset.
+    BGPRib *rib;
+    uint32_t peer;
+
+    BGPPeerTrace *trace; // latency tracing of sampled UPDATEs
+    bool add_path; // the peer sends path IDs, see BGPOpenMessage::negotiateAddPath
+    bool as4; // AS_PATH has 4-byte ASNs, see BGPOpenMessage::negotiateAs4. true by default, as without a context
+
+    uint64_t prefixes_filtered;
+    uint64_t updates_treated_as_withdraw;
+    uint64_t updates_attribute_discarded;
+
+    BGPParseContext();
+} BGPParseContext;
+
 typedef struct BGPPacket {
     uint16_t length;
     uint8_t type;
     BGPOpenMessage open;
     BGPUpdateMessage update;
     BGPNotificationMessage notification;
+    BGPParseContext *context;
 
     BGPPacket();
     BGPPacket(uint8_t *buffer);
+    BGPPacket(uint8_t *buffer, BGPParseContext *context);
     int write(uint8_t *buffer);
     uint8_t* read(uint8_t *buffer);
 } BGPPacket;
@@ -136,6 +284,8 @@ namespace Builders {
     int buildHeader(uint8_t *buffer, const BGPPacket &source);
     int buildOpenMessage(uint8_t *buffer, const BGPPacket &source);
     int buildUpdateMessage(uint8_t *buffer, const BGPPacket &source);
+    int buildPathAttribute(uint8_t *buffer, const BGPPathAttribute &attr); // flags, type, length and value
+    size_t sizeOfPathAttribute(const BGPPathAttribute &attr);
     int buildNofiticationMessage(uint8_t *buffer, const BGPPacket &source);
 }
 
@@ -0,0 +1,26 @@
+#include <stdint.h>
+#include "nexthop.h"
+
+namespace LibBGP {
+
+BGPNextHop::BGPNextHop(uint32_t address) {
+    this->addr = address;
+    this->up = true; // until the IGP says otherwise
+    this->cost = 0;
+    this->paths = 0;
+    this->queued = false;
+}
+
+uint32_t BGPNextHop::address() const {
+    return this->addr;
+}
+
+bool BGPNextHop::reachable() const {
+    return this->up.load(std::memory_order_relaxed);
+}
+
+uint32_t BGPNextHop::metric() const {
+    return this->cost.load(std::memory_order_relaxed);
+}
+
+}
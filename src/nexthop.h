@@ -0,0 +1,48 @@
+#ifndef LIBBGP_NEXTHOP_H
+#define LIBBGP_NEXTHOP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "libbgp.h"
+
+namespace LibBGP {
+
+/* a next-hop as the IGP sees it, shared by every attribute set that carries
+ * it. its state is read without locks, so a forwarding path holding a best
+ * route sees a next-hop go down the moment it is set, before best-path has
+ * been re-run for the prefixes using it.
+ */
+class BGPNextHop {
+public:
+    BGPNextHop(uint32_t address);
+
+    uint32_t address() const; // network byte order
+    bool reachable() const;
+    uint32_t metric() const; // IGP cost to reach it
+
+private:
+    friend class BGPRib;
+    BGPNextHop(const BGPNextHop &) = delete;
+    BGPNextHop& operator= (const BGPNextHop &) = delete;
+
+    uint32_t addr;
+    std::atomic<bool> up;
+    std::atomic<uint32_t> cost;
+
+    // the path group, kept by the RIB under its writer lock. routes may
+    // hold prefixes that no longer use this next-hop, or the same prefix
+    // twice; they are weeded out when the group is re-run or grows past
+    // twice the paths it has.
+    size_t paths;
+    std::vector<BGPRoute> routes;
+    bool queued; // state changed since the last commit
+};
+
+typedef std::shared_ptr<BGPNextHop> BGPNextHopRef;
+
+}
+
+#endif // LIBBGP_NEXTHOP_H
@@ -1,10 +1,13 @@
 #include <arpa/inet.h>
 #include <stdint.h>
 #include <string.h>
+#include <algorithm>
 #include <utility>
 #include <stdlib.h>
 #include <iostream>
 #include "libbgp.h"
+#include "policy.h"
+#include "rib.h"
 
 namespace LibBGP {
 
@@ -75,6 +78,39 @@ uint8_t* parseOpenMessage(uint8_t *buffer, BGPPacket *parsed) {
                         cap.my_asn = ntohl(getValue<uint32_t> (&buffer));
                         break;
                     }
+                    case 64: { // Graceful Restart, flags and time, then (afi, safi, flags) per 4 bytes
+                        uint8_t *cap_end = buffer + cap.length;
+                        if (cap.length >= 2) {
+                            uint16_t restart = ntohs(getValue<uint16_t> (&buffer));
+                            cap.restart_flags = restart >> 12;
+                            cap.restart_time = restart & 0x0fff;
+                        }
+                        while (cap_end - buffer >= 4) {
+                            uint16_t afi = ntohs(getValue<uint16_t> (&buffer));
+                            uint8_t safi = getValue<uint8_t> (&buffer);
+                            uint8_t af_flags = getValue<uint8_t> (&buffer);
+                            if (afi != 1 || safi != 1) continue;
+                            cap.afi = afi;
+                            cap.safi = safi;
+                            cap.af_flags = af_flags;
+                        }
+                        buffer = cap_end;
+                        break;
+                    }
+                    case 69: { // ADD-PATH, one (afi, safi, send/receive) per 4 bytes
+                        uint8_t *cap_end = buffer + cap.length;
+                        while (cap_end - buffer >= 4) {
+                            uint16_t afi = ntohs(getValue<uint16_t> (&buffer));
+                            uint8_t safi = getValue<uint8_t> (&buffer);
+                            uint8_t send_receive = getValue<uint8_t> (&buffer);
+                            if (afi != 1 || safi != 1) continue;
+                            cap.afi = afi;
+                            cap.safi = safi;
+                            cap.send_receive = send_receive;
+                        }
+                        buffer = cap_end;
+                        break;
+                    }
                     default: buffer += cap.length;
                 }
 
@@ -92,33 +128,82 @@ uint8_t* parseOpenMessage(uint8_t *buffer, BGPPacket *parsed) {
     return buffer;
 }
 
+/* read one prefix of a withdrawn routes / nlri field, false if malformed.
+ * with add_path, it comes after a path identifier.
+ */
+static bool readPrefix(uint8_t **buffer, uint8_t *end, BGPRoute *route, bool add_path) {
+    route->path_id = 0;
+    if (add_path) {
+        if (end - *buffer < 4) return false;
+        route->path_id = ntohl(getValue<uint32_t> (buffer));
+    }
+
+    if (*buffer >= end) return false;
+    route->length = getValue<uint8_t> (buffer);
+    route->prefix = 0;
+
+    int prefix_buffer_size = (route->length + 7) / 8;
+    if (route->length > 32 || end - *buffer < prefix_buffer_size) return false;
+    if (prefix_buffer_size > 0) memcpy(&route->prefix, *buffer, prefix_buffer_size);
+    *buffer += prefix_buffer_size;
+    return true;
+}
+
 uint8_t* parseUpdateMessage(uint8_t *buffer, BGPPacket *parsed) {
     auto &msg = parsed->update;
-    msg.withdrawn_len = ntohs(getValue<uint16_t> (&buffer));
-    auto &withdrawn_routes = msg.withdrawn_routes;
+    auto *ctx = parsed->context;
 
-    int parsed_routes_len = 0;
-    while (parsed_routes_len < msg.withdrawn_len) {
-        BGPRoute route;
-        route.length = getValue<uint8_t> (&buffer);
+    if (ctx && ctx->trace) msg.trace = ctx->trace->start();
+    msg.add_path = ctx && ctx->add_path;
+
+    if (parsed->length < 23) {
+        msg.setError(BGP_UPDATE_SESSION_RESET, 1, 0);
+        return buffer;
+    }
 
-        int prefix_buffer_size = (route.length + 7) / 8;
-        if (route.length > 32) return buffer;
-        memcpy(&route.prefix, buffer, prefix_buffer_size);
+    uint8_t *end = buffer + parsed->length - 19; // 19: header
 
-        buffer += prefix_buffer_size;
-        parsed_routes_len += prefix_buffer_size + 1;
+    // no withdrawn routes, no attributes, no nlri.
+    msg.end_of_rib = parsed->length == 23 && !buffer[0] && !buffer[1] && !buffer[2] && !buffer[3];
+
+    msg.withdrawn_len = ntohs(getValue<uint16_t> (&buffer));
+    if (end - buffer < msg.withdrawn_len + 2) {
+        msg.setError(BGP_UPDATE_SESSION_RESET, 1, 0); // Malformed Attribute List
+        return end;
+    }
+
+    auto &withdrawn_routes = msg.withdrawn_routes;
+    uint8_t *withdrawn_end = buffer + msg.withdrawn_len;
+    while (buffer < withdrawn_end) {
+        BGPRoute route;
+        if (!readPrefix(&buffer, withdrawn_end, &route, msg.add_path)) {
+            msg.setError(BGP_UPDATE_SESSION_RESET, 10, 0); // Invalid Network Field
+            return end;
+        }
         withdrawn_routes.push_back(route);
     }
     
     //msg.withdrawn_routes = withdrawn_routes;
     msg.path_attribute_length = ntohs(getValue<uint16_t> (&buffer));
+    if (end - buffer < msg.path_attribute_length) {
+        msg.setError(BGP_UPDATE_SESSION_RESET, 1, 0);
+        return end;
+    }
+
     auto &attrs = msg.path_attribute;
+    uint8_t *attrib_end = buffer + msg.path_attribute_length;
+    uint8_t seen[32]; // attribute types seen so far, one bit each
+    memset(seen, 0, sizeof(seen));
 
-    int pasred_attrib_len = 0;
-    while (pasred_attrib_len < msg.path_attribute_length) {
+    while (buffer < attrib_end) {
         BGPPathAttribute attr;
 
+        // RFC 7606 4: the nlri can still be found, so this is treat-as-withdraw.
+        if (attrib_end - buffer < 3) {
+            msg.setError(BGP_UPDATE_TREAT_AS_WITHDRAW, 5, 0); // Attribute Length Error
+            break;
+        }
+
         uint8_t flags = getValue<uint8_t> (&buffer);
         attr.optional = flags >> 7 & 0x1;
         attr.transitive = (flags >> 6) & 0x1;
@@ -127,114 +212,160 @@ uint8_t* parseUpdateMessage(uint8_t *buffer, BGPPacket *parsed) {
 
         attr.type = getValue<uint8_t> (&buffer);
 
+        if (attr.extened && attrib_end - buffer < 2) {
+            msg.setError(BGP_UPDATE_TREAT_AS_WITHDRAW, 5, attr.type);
+            break;
+        }
+
         if (attr.extened) attr.length = ntohs(getValue<uint16_t> (&buffer));
         else attr.length = getValue<uint8_t> (&buffer);
 
-        pasred_attrib_len += 2 + (attr.extened ? 2 : 1); // 2: uint8_t flags + uint8_t type
+        if (attrib_end - buffer < attr.length) {
+            msg.setError(BGP_UPDATE_TREAT_AS_WITHDRAW, 5, attr.type);
+            break;
+        }
+
+        uint8_t *value = buffer;
+        uint8_t *next = buffer + attr.length;
 
-        if (attr.length == 0 && attr.type != 6) { // 6: only attr always 0 len. 
-            attrs.push_back(attr);
+        if (seen[attr.type / 8] & (1 << (attr.type % 8))) { // RFC 7606 3.g: keep the first one
+            msg.setError(BGP_UPDATE_ATTRIBUTE_DISCARD, 1, attr.type);
+            buffer = next;
             continue;
         }
+        seen[attr.type / 8] |= 1 << (attr.type % 8);
 
-        switch (attr.type) {
-            case 1:  // ORIGIN
-                attr.origin = getValue<uint8_t> (&buffer); 
-                pasred_attrib_len++; 
-                break;
-            case 2: { // AS_PATH
-                BGPASPath as_path;
-                as_path.type = getValue<uint8_t> (&buffer);
-                as_path.length = getValue<uint8_t> (&buffer);
-                std::vector<uint32_t> path;
-
-                // sometime that happen.
-                bool as4_in_path = (4 * as_path.length) == (attr.length - 2);
-
-                for (int i = 0; i < as_path.length; i++)
-                    if (as4_in_path) path.push_back(ntohl(getValue<uint32_t> (&buffer)));
-                    else path.push_back(ntohs(getValue<uint16_t> (&buffer)));
-                as_path.path = path;
-                attr.as_path = as_path;
-                pasred_attrib_len += 2 + (as4_in_path ? 4 : 2) * as_path.length;
-                break;
-            }
-            case 3: // NEXTHOP
-                attr.next_hop = getValue<uint32_t> (&buffer); 
-                pasred_attrib_len +=4; 
-                break;
-            case 4: // MED
-                attr.med = ntohl(getValue<uint32_t> (&buffer)); 
-                pasred_attrib_len +=4;
-                break;
-            case 5: // L_PREF
-                attr.local_pref = ntohl(getValue<uint32_t> (&buffer)); 
-                pasred_attrib_len +=4; 
-                break;
-            case 6: // AA
-                if (attr.length != 0) return buffer;
-                else attr.atomic_aggregate = true;
-                break;
-            case 7: // AGGR
-                attr.aggregator_asn = ntohs(getValue<uint16_t> (&buffer));
-                attr.aggregator = getValue<uint32_t> (&buffer);
-                pasred_attrib_len +=6;
-                break;
-            case 17: { // AS4_PATH
-                BGPASPath as_path;
-                as_path.type = getValue<uint8_t> (&buffer);
-                as_path.length = getValue<uint8_t> (&buffer);
-                std::vector<uint32_t> path;
-                for (int i = 0; i < as_path.length; i++)
-                    path.push_back(ntohl(getValue<uint32_t> (&buffer)));
-                as_path.path = path;
-                attr.as4_path = as_path;
-                pasred_attrib_len += 2 + 4 * as_path.length;
-                break;
-            }
-            case 18: // AGGR4
-                attr.aggregator_asn4 = ntohl(getValue<uint32_t> (&buffer));
-                attr.aggregator = getValue<uint32_t> (&buffer);
-                pasred_attrib_len += 8;
-                break;
-            default: {
-                pasred_attrib_len += attr.length;
-                buffer += attr.length;
-                break;
-            };
+        // action for a malformed one and the flags of the well-known ones
+        // come with the handler, see attribute.cc.
+        auto &handler = BGPAttributeRegistry::handler(attr.type);
+        buffer = next;
+
+        if (handler.well_known && (attr.optional || !attr.transitive)) {
+            msg.setError(handler.on_error, 4, attr.type); // Attribute Flags Error
+            continue;
+        }
+
+        if (attr.type == 2 || attr.type == 7) attr.peer_as4_ok = !ctx || ctx->as4;
+
+        uint8_t subcode = handler.decode(attr, value);
+        if (subcode == BGPAttributeHandler::DROP) continue;
+        if (subcode) {
+            msg.setError(handler.on_error, subcode, attr.type);
+            continue;
         }
-        attrs.push_back(attr);
+
+        attrs.push_back(std::move(attr));
     } // attr parse loop
 
+
     //msg.path_attribute = attrs;
+    buffer = attrib_end;
+
+    auto has = [&msg](uint8_t type) { return msg.getAttrib(type) != NULL; };
 
-    int nlri_len = parsed->length - 23 - msg.withdrawn_len - msg.path_attribute_length;
-    if (nlri_len < 0) return buffer;
+    // RFC 7606 3.d: missing well-known mandatory attribute.
+    if (buffer < end && (!has(1) || !has(2) || !has(3)))
+        msg.setError(BGP_UPDATE_TREAT_AS_WITHDRAW, 3, !has(1) ? 1 : (!has(2) ? 2 : 3)); // Missing Well-known Attribute
+
+    bool withdraw = msg.error_action >= BGP_UPDATE_TREAT_AS_WITHDRAW;
+
+    if (ctx && msg.error_action == BGP_UPDATE_ATTRIBUTE_DISCARD) ctx->updates_attribute_discarded++;
+    if (ctx && withdraw) ctx->updates_treated_as_withdraw++;
+
+    const BGPRouteMap *route_map = (ctx && !withdraw) ? ctx->route_map : NULL;
+    uint64_t attr_mask = route_map ? route_map->matchAttributes(msg) : 0;
+    int applied_term = -1;
+
+    // max-prefix: only nlri this peer gets to keep count, checked against
+    // what the RIB holds before this UPDATE. counted alone, re-announced
+    // prefixes count too; an UPDATE over by that count is looked up in
+    // ctx->rib if there is one, so only new prefixes count, less withdrawn
+    // ones. without a RIB the check is up to one UPDATE early, never late.
+    BGPPeerAccounting *accounting = (ctx && !withdraw) ? ctx->accounting : NULL;
+    uint64_t headroom = accounting ? accounting->headroom() : UINT64_MAX;
+    bool recount = accounting && ctx->rib;
+    uint64_t accepted = 0;
 
     auto &nlri = msg.nlri;
-    parsed_routes_len = 0;
-    while (parsed_routes_len < nlri_len) {
+    while (buffer < end) {
         BGPRoute route;
-        route.length = getValue<uint8_t> (&buffer);
-        route.prefix = 0;
+        if (!readPrefix(&buffer, end, &route, msg.add_path)) {
+            msg.setError(BGP_UPDATE_SESSION_RESET, 10, 0);
+            return end;
+        }
+
+        if (withdraw) {
+            withdrawn_routes.push_back(route);
+            continue;
+        }
 
-        int prefix_buffer_size = (route.length + 7) / 8;
-        if (route.length > 32) return buffer;
-        if (prefix_buffer_size > 0) memcpy(&route.prefix, buffer, prefix_buffer_size);
+        if (route_map) {
+            int term = route_map->evaluate(route, attr_mask);
+            if (term < 0) {
+                ctx->prefixes_filtered++;
+                continue;
+            }
+
+            if (applied_term < 0) applied_term = term;
+            else if (!route_map->sameActions(term, applied_term)) {
+                if (++accepted > headroom && !recount) break;
+                auto split = std::find_if(msg.nlri_split.begin(), msg.nlri_split.end(), [route_map, term](const BGPUpdateSplit &s) {
+                    return route_map->sameActions(term, s.term);
+                });
+                if (split == msg.nlri_split.end()) {
+                    msg.nlri_split.push_back(BGPUpdateSplit());
+                    split = msg.nlri_split.end() - 1;
+                    split->term = term;
+                }
+                split->nlri.push_back(route);
+                continue;
+            }
+        }
 
-        buffer += prefix_buffer_size;
-        parsed_routes_len += prefix_buffer_size + 1;
+        if (++accepted > headroom && !recount) break;
         nlri.push_back(route);
     }
+
+    if (accepted > headroom && recount) {
+        std::vector<BGPRoute> announced(nlri);
+        for (auto &split : msg.nlri_split) announced.insert(announced.end(), split.nlri.begin(), split.nlri.end());
+        int64_t change = ctx->rib->prefixChange(ctx->peer, announced, withdrawn_routes);
+        accepted = change > 0 ? change : 0;
+    }
+
+    if (accepted > headroom) {
+        accounting->exceed();
+        msg.setError(BGP_UPDATE_SESSION_RESET, 1, 0, 6); // Cease, Maximum Number of Prefixes Reached
+        return end;
+    }
+
+    if (accounting) accounting->checkWarning(accepted);
+
+    // set actions go on last, so that every group starts from the
+    // attributes as received.
+    for (auto &split : msg.nlri_split) {
+        BGPUpdateMessage applied;
+        applied.path_attribute = msg.path_attribute;
+        route_map->apply(split.term, applied);
+        split.path_attribute.swap(applied.path_attribute);
+    }
+    if (applied_term >= 0) route_map->apply(applied_term, msg);
     //msg.nlri = nlri;
 
     //parsed.update = msg;
-    return buffer;
+    return end;
 }
 
 uint8_t* parseNofiticationMessage(uint8_t *buffer, BGPPacket *parsed) {
-    // TODO
-    return buffer;
+    auto &msg = parsed->notification;
+    if (parsed->length < 21) return buffer;
+    uint8_t *end = buffer + parsed->length - 19; // 19: header
+
+    msg.error_code = getValue<uint8_t> (&buffer);
+    msg.error_subcode = getValue<uint8_t> (&buffer);
+    msg.data.assign(buffer, end);
+
+    return end;
 }
 
 } // Parsers
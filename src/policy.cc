@@ -0,0 +1,217 @@
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "policy.h"
+
+namespace LibBGP {
+
+BGPPrefixListEntry::BGPPrefixListEntry() {
+    memset(this, 0, sizeof(BGPPrefixListEntry));
+}
+
+BGPPrefixListEntry::BGPPrefixListEntry(uint32_t seq, bool permit, uint32_t prefix, uint8_t length, uint8_t ge, uint8_t le) {
+    this->seq = seq;
+    this->permit = permit;
+    this->prefix = prefix;
+    this->length = length;
+    this->ge = ge;
+    this->le = le;
+}
+
+BGPRouteMapTerm::BGPRouteMapTerm() {
+    memset(this, 0, sizeof(BGPRouteMapTerm));
+    this->match_prefix_list = -1;
+    this->match_as_path_regex = -1;
+}
+
+bool BGPPrefixList::add(const BGPPrefixListEntry &entry) {
+    if (entry.length > 32 || entry.ge > 32 || entry.le > 32) return false;
+    if (entry.ge && entry.ge < entry.length) return false;
+    if (entry.le && entry.le < (entry.ge ? entry.ge : entry.length)) return false;
+    this->entries.push_back(entry);
+    return true;
+}
+
+void BGPPrefixList::compile() {
+    auto sorted = this->entries;
+    std::stable_sort(sorted.begin(), sorted.end(), [](const BGPPrefixListEntry &a, const BGPPrefixListEntry &b) {
+        return a.seq < b.seq;
+    });
+
+    // build the trie first, remembering which node each entry lands on.
+    std::vector<std::pair<uint32_t, Rule>> placed;
+    Node root;
+    memset(&root, 0, sizeof(Node));
+    root.child[0] = root.child[1] = -1;
+    this->nodes.assign(1, root);
+
+    for (auto &e : sorted) {
+        uint32_t prefix = ntohl(e.prefix);
+        uint32_t node = 0;
+        for (int depth = 0; depth < e.length; depth++) {
+            int bit = (prefix >> (31 - depth)) & 0x1;
+            if (this->nodes[node].child[bit] < 0) {
+                Node n;
+                memset(&n, 0, sizeof(Node));
+                n.child[0] = n.child[1] = -1;
+                this->nodes.push_back(n);
+                this->nodes[node].child[bit] = this->nodes.size() - 1;
+            }
+            node = this->nodes[node].child[bit];
+        }
+
+        uint8_t lo = e.ge ? e.ge : e.length;
+        uint8_t hi = e.le ? e.le : (e.ge ? 32 : e.length);
+
+        Rule rule;
+        rule.seq = e.seq;
+        rule.permit = e.permit;
+        rule.lengths = 0;
+        for (int l = lo; l <= hi; l++) rule.lengths |= 1ULL << l;
+        placed.push_back(std::make_pair(node, rule));
+    }
+
+    // then lay the rules out so every node owns one contiguous, seq-ordered run.
+    std::stable_sort(placed.begin(), placed.end(), [](const std::pair<uint32_t, Rule> &a, const std::pair<uint32_t, Rule> &b) {
+        return a.first < b.first;
+    });
+
+    this->rules.clear();
+    for (auto &p : placed) {
+        auto &node = this->nodes[p.first];
+        if (!node.lengths && node.rule_begin == node.rule_end) node.rule_begin = node.rule_end = this->rules.size();
+        node.lengths |= p.second.lengths;
+        node.rule_end++;
+        this->rules.push_back(p.second);
+    }
+}
+
+bool BGPPrefixList::permits(const BGPRoute &route) const {
+    if (!this->nodes.size() || route.length > 32) return false;
+
+    uint32_t prefix = ntohl(route.prefix);
+    uint64_t len_bit = 1ULL << route.length;
+    const Rule *best = NULL;
+    int32_t node = 0;
+
+    for (int depth = 0; node >= 0; depth++) {
+        auto &n = this->nodes[node];
+        if (n.lengths & len_bit) {
+            for (uint32_t i = n.rule_begin; i < n.rule_end; i++) {
+                auto &r = this->rules[i];
+                if (best && r.seq >= best->seq) break;
+                if (r.lengths & len_bit) {
+                    best = &r;
+                    break;
+                }
+            }
+        }
+        if (depth == route.length) break;
+        node = n.child[(prefix >> (31 - depth)) & 0x1];
+    }
+
+    return best ? best->permit : false;
+}
+
+int BGPRouteMap::addPrefixList(const BGPPrefixList &list) {
+    this->prefix_lists.push_back(list);
+    return this->prefix_lists.size() - 1;
+}
+
+int BGPRouteMap::addAsPathRegex(const char *regex) {
+    BGPAsPathRegex compiled;
+    if (!compiled.compile(regex)) return -1;
+    this->as_path_regexes.push_back(compiled);
+    return this->as_path_regexes.size() - 1;
+}
+
+bool BGPRouteMap::addTerm(const BGPRouteMapTerm &term) {
+    if (this->terms.size() >= MAX_TERMS) return false;
+    if (term.match_prefix_list >= (int) this->prefix_lists.size()) return false;
+    if (term.match_as_path_regex >= (int) this->as_path_regexes.size()) return false;
+    this->terms.push_back(term);
+    return true;
+}
+
+void BGPRouteMap::compile() {
+    std::stable_sort(this->terms.begin(), this->terms.end(), [](const BGPRouteMapTerm &a, const BGPRouteMapTerm &b) {
+        return a.seq < b.seq;
+    });
+
+    for (auto &list : this->prefix_lists) list.compile();
+
+    this->program.clear();
+    for (unsigned int i = 0; i < this->terms.size(); i++) {
+        auto &t = this->terms[i];
+        Insn insn;
+        insn.prefix_list = t.match_prefix_list;
+        insn.max_length = t.match_max_length;
+        insn.permit = t.permit;
+        insn.action_id = i;
+
+        for (unsigned int j = 0; j < i; j++) {
+            auto &o = this->terms[j];
+            if (o.set_local_pref == t.set_local_pref && o.set_med == t.set_med &&
+                (!t.set_local_pref || o.local_pref == t.local_pref) &&
+                (!t.set_med || o.med == t.med)) {
+                insn.action_id = this->program[j].action_id;
+                break;
+            }
+        }
+
+        this->program.push_back(insn);
+    }
+}
+
+uint64_t BGPRouteMap::matchAttributes(BGPUpdateMessage &msg) const {
+    uint64_t mask = 0;
+    auto path = msg.getAsPath();
+
+    for (unsigned int i = 0; i < this->terms.size(); i++) {
+        auto &t = this->terms[i];
+
+        if (t.match_origin_as || t.match_as_path_contains || t.match_as_path_max_len) {
+            if (!path) continue;
+            if (t.match_origin_as && path->origin() != t.match_origin_as) continue;
+            if (t.match_as_path_max_len && path->size() > t.match_as_path_max_len) continue;
+            if (t.match_as_path_contains && !path->contains(t.match_as_path_contains)) continue;
+        }
+
+        if (t.match_community && !msg.hasCommunity(t.match_community)) continue;
+        if (t.match_large_community && !msg.hasLargeCommunity(t.large_community)) continue;
+
+        if (t.match_as_path_regex >= 0) {
+            auto &regex = this->as_path_regexes[t.match_as_path_regex];
+            if (!regex.matchCached(path ? *path : BGPAsPath())) continue;
+        }
+
+        mask |= 1ULL << i;
+    }
+
+    return mask;
+}
+
+int BGPRouteMap::evaluate(const BGPRoute &route, uint64_t attr_mask) const {
+    for (unsigned int i = 0; attr_mask && i < this->program.size(); i++, attr_mask >>= 1) {
+        if (!(attr_mask & 0x1)) continue;
+        auto &insn = this->program[i];
+        if (insn.max_length && route.length > insn.max_length) continue;
+        if (insn.prefix_list >= 0 && !this->prefix_lists[insn.prefix_list].permits(route)) continue;
+        return insn.permit ? i : -1;
+    }
+
+    return -1;
+}
+
+void BGPRouteMap::apply(int term, BGPUpdateMessage &msg) const {
+    auto &t = this->terms[term];
+    if (t.set_local_pref) msg.setLocalPref(t.local_pref);
+    if (t.set_med) msg.setMed(t.med);
+}
+
+bool BGPRouteMap::sameActions(int a, int b) const {
+    return this->program[a].action_id == this->program[b].action_id;
+}
+
+}
@@ -0,0 +1,121 @@
+#ifndef LIBBGP_POLICY_H
+#define LIBBGP_POLICY_H
+
+#include <stdint.h>
+#include <vector>
+#include "libbgp.h"
+#include "aspath_regex.h"
+
+namespace LibBGP {
+
+typedef struct BGPPrefixListEntry {
+    uint32_t seq;
+    bool permit;
+    uint32_t prefix; // network byte order, same as BGPRoute::prefix
+    uint8_t length;
+    uint8_t ge; // 0: not set
+    uint8_t le; // 0: not set
+
+    BGPPrefixListEntry();
+    BGPPrefixListEntry(uint32_t seq, bool permit, uint32_t prefix, uint8_t length, uint8_t ge, uint8_t le);
+} BGPPrefixListEntry;
+
+/* prefix-list compiled into a binary trie. every node on the path of a route
+ * carries a bitmap of the prefix lengths its entries accept, so a lookup is
+ * one walk down at most 33 nodes and entries are only looked at on a hit.
+ */
+class BGPPrefixList {
+public:
+    bool add(const BGPPrefixListEntry &entry);
+    void compile(); // must be called after the last add()
+
+    // true if the first matching entry (in seq order) permits. no match: deny.
+    bool permits(const BGPRoute &route) const;
+
+private:
+    typedef struct Rule {
+        uint32_t seq;
+        uint64_t lengths;
+        bool permit;
+    } Rule;
+
+    typedef struct Node {
+        int32_t child[2];
+        uint64_t lengths; // OR of lengths of rules on this node
+        uint32_t rule_begin;
+        uint32_t rule_end;
+    } Node;
+
+    std::vector<BGPPrefixListEntry> entries;
+    std::vector<Node> nodes;
+    std::vector<Rule> rules;
+};
+
+typedef struct BGPRouteMapTerm {
+    uint32_t seq;
+    bool permit;
+
+    int match_prefix_list; // index returned by BGPRouteMap::addPrefixList, -1: any
+    uint8_t match_max_length; // 0: any
+    uint32_t match_origin_as; // 0: any
+    uint32_t match_as_path_contains; // 0: any
+    uint8_t match_as_path_max_len; // 0: any
+    int match_as_path_regex; // index returned by BGPRouteMap::addAsPathRegex, -1: any
+    uint32_t match_community; // 0: any
+    bool match_large_community;
+    BGPLargeCommunity large_community;
+
+    bool set_local_pref;
+    uint32_t local_pref;
+    bool set_med;
+    uint32_t med;
+
+    BGPRouteMapTerm();
+} BGPRouteMapTerm;
+
+/* route-map compiled into a flat program. attribute conditions are the same
+ * for every prefix in an UPDATE, so they are evaluated once per message into
+ * a bitmask (one bit per term), and the per-prefix part only does the
+ * prefix-list and length checks of the terms whose bit is set.
+ */
+class BGPRouteMap {
+public:
+    enum { MAX_TERMS = 64 };
+
+    int addPrefixList(const BGPPrefixList &list);
+    int addAsPathRegex(const char *regex); // -1 if regex does not compile
+    bool addTerm(const BGPRouteMapTerm &term);
+    void compile(); // must be called after the last addTerm()
+
+    /* bit n set: the attribute conditions of term n hold for msg. AS-path
+     * conditions see the path of getAsPath(), and regex results are cached
+     * per interned path.
+     */
+    uint64_t matchAttributes(BGPUpdateMessage &msg) const;
+
+    // index of the permitting term, -1 if denied (explicitly or implicitly).
+    int evaluate(const BGPRoute &route, uint64_t attr_mask) const;
+
+    // apply the set actions of term to msg.
+    void apply(int term, BGPUpdateMessage &msg) const;
+
+    // true if term a and b would apply the same set actions.
+    bool sameActions(int a, int b) const;
+
+private:
+    typedef struct Insn {
+        int16_t prefix_list;
+        uint8_t max_length;
+        bool permit;
+        uint16_t action_id; // terms with equal set actions share an id
+    } Insn;
+
+    std::vector<BGPPrefixList> prefix_lists;
+    std::vector<BGPAsPathRegex> as_path_regexes;
+    std::vector<BGPRouteMapTerm> terms;
+    std::vector<Insn> program;
+};
+
+}
+
+#endif // LIBBGP_POLICY_H
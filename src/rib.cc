@@ -0,0 +1,946 @@
+#include <arpa/inet.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <thread>
+#include "rib.h"
+
+namespace LibBGP {
+
+typedef struct BGPRibNode {
+    BGPRibNode *child[2];
+    uint32_t prefix; // host byte order, bits past length are 0
+    uint8_t length;
+    bool has_entry;
+    uint64_t version; // batch that created it, writable while that batch is open
+    BGPRibEntry entry;
+} BGPRibNode;
+
+typedef struct BGPRibVersion {
+    BGPRibNode *root;
+    size_t routes;
+    uint64_t id;
+} BGPRibVersion;
+
+// charged to a peer per path it has in the table, node included.
+static const size_t ROUTE_BYTES = sizeof(BGPRibPath) + sizeof(BGPRibNode);
+
+static inline int bitAt(uint32_t prefix, int i) {
+    return (prefix >> (31 - i)) & 0x1;
+}
+
+static inline uint32_t maskOf(uint8_t length) {
+    return length ? ~0U << (32 - length) : 0;
+}
+
+static inline uint8_t commonLength(uint32_t a, uint32_t b, uint8_t max) {
+    uint32_t diff = a ^ b;
+    uint8_t common = diff ? __builtin_clz(diff) : 32;
+    return common < max ? common : max;
+}
+
+BGPRibAttributes::BGPRibAttributes(const std::vector<BGPPathAttribute> &path_attribute) {
+    this->path_attribute = path_attribute;
+    this->origin = 0;
+    this->next_hop = 0;
+    this->med = 0;
+    this->local_pref = 100; // RFC 4271 does not say, but everyone does
+    this->as_path_length = 0;
+    memset(&this->trace, 0, sizeof(this->trace));
+
+    BGPAsPath as4_path;
+    for (auto &attr : path_attribute) {
+        switch (attr.type) {
+            case 1: this->origin = attr.origin; break;
+            case 2: this->as_path = attr.as_path.path; break;
+            case 3: this->next_hop = attr.next_hop; break;
+            case 4: this->med = attr.med; break;
+            case 5: this->local_pref = attr.local_pref; break;
+            case 17: as4_path = attr.as4_path.path; break;
+            default: break;
+        }
+    }
+
+    if (!as4_path.empty()) this->as_path = this->as_path.empty() ? as4_path : BGPAsPath::reconstruct(this->as_path, as4_path);
+    this->as_path_length = this->as_path.length();
+}
+
+// AS paths are interned and shared across peers, so not charged here.
+static size_t footprint(const BGPRibAttributes &attributes) {
+    return sizeof(BGPRibAttributes) + attributes.path_attribute.capacity() * sizeof(BGPPathAttribute);
+}
+
+// generation is only changed in place by BGPRib::refresh(), which keeps a path live.
+bool BGPRibPath::live() const {
+    return __atomic_load_n(&this->generation, __ATOMIC_RELAXED) >= this->owner->floor.load(std::memory_order_relaxed);
+}
+
+bool BGPRibPath::stale() const {
+    return this->live() && __atomic_load_n(&this->generation, __ATOMIC_RELAXED) < this->owner->generation.load(std::memory_order_relaxed);
+}
+
+/* same set as far as best-path and an outbound UPDATE go: the same
+ * attributes, value for value, as the codec would write them.
+ */
+static bool sameAttributes(const BGPRibAttributes &a, const BGPRibAttributes &b) {
+    if (&a == &b) return true;
+    if (a.origin != b.origin || a.next_hop != b.next_hop || a.med != b.med || a.local_pref != b.local_pref) return false;
+    if (a.as_path.id() != b.as_path.id() || a.path_attribute.size() != b.path_attribute.size()) return false;
+
+    std::vector<uint8_t> x, y;
+    for (size_t i = 0; i < a.path_attribute.size(); i++) {
+        auto &p = a.path_attribute[i], &q = b.path_attribute[i];
+        if (p.type != q.type || p.optional != q.optional || p.transitive != q.transitive || p.partial != q.partial) return false;
+
+        auto &handler = BGPAttributeRegistry::handler(p.type);
+        size_t size = handler.size(p);
+        if (size != handler.size(q)) return false;
+        if (!size) continue;
+
+        x.resize(size);
+        y.resize(size);
+        handler.encode(p, x.data());
+        handler.encode(q, y.data());
+        if (memcmp(x.data(), y.data(), size)) return false;
+    }
+
+    return true;
+}
+
+// RFC 4271 9.1.2.1: a path whose next-hop does not resolve is left out, as
+// is one damping suppressed (RFC 2439 4.4).
+static inline bool usable(const BGPRibPath &path) {
+    auto &nexthop = path.attributes->nexthop;
+    return path.live() && !__atomic_load_n(&path.suppressed, __ATOMIC_RELAXED) && (!nexthop || nexthop->reachable());
+}
+
+static inline uint32_t metricOf(const BGPRibAttributes &attributes) {
+    return attributes.nexthop ? attributes.nexthop->metric() : 0;
+}
+
+/* RFC 4271 9.1.2.2, minus the steps that need session information. MED
+ * only counts between paths from the same neighbor AS (9.1.2.2 c), so which
+ * path wins can depend on the order choose() sees them in.
+ */
+static bool better(const BGPRibPath &a, const BGPRibPath &b) {
+    auto &x = *a.attributes, &y = *b.attributes;
+    if (x.local_pref != y.local_pref) return x.local_pref > y.local_pref;
+    if (x.as_path_length != y.as_path_length) return x.as_path_length < y.as_path_length;
+    if (x.origin != y.origin) return x.origin < y.origin;
+    if (x.med != y.med && x.as_path.front() == y.as_path.front()) return x.med < y.med;
+    if (metricOf(x) != metricOf(y)) return metricOf(x) < metricOf(y);
+    if (a.peer != b.peer) return a.peer < b.peer;
+    return a.path_id < b.path_id;
+}
+
+static int choose(const BGPRibEntry &entry) {
+    int best = -1;
+    for (unsigned int i = 0; i < entry.paths.size(); i++) {
+        if (!usable(entry.paths[i])) continue;
+        if (best < 0 || better(entry.paths[i], entry.paths[best])) best = i;
+    }
+    return best;
+}
+
+void BGPRib::select(BGPRibEntry &entry) {
+    entry.best = choose(entry);
+}
+
+const BGPRibPath* BGPRibEntry::getBest() const {
+    int best = __atomic_load_n(&this->best, __ATOMIC_RELAXED);
+    if (best >= 0 && !usable(this->paths[best])) best = choose(*this);
+    return best >= 0 ? &this->paths[best] : NULL;
+}
+
+BGPRibSnapshot::BGPRibSnapshot(const BGPRib *rib, int slot, const BGPRibVersion *current) {
+    this->rib = rib;
+    this->slot = slot;
+    this->current = current;
+}
+
+BGPRibSnapshot::BGPRibSnapshot(BGPRibSnapshot &&other) {
+    this->rib = other.rib;
+    this->slot = other.slot;
+    this->current = other.current;
+    other.rib = NULL;
+}
+
+BGPRibSnapshot::~BGPRibSnapshot() {
+    if (this->rib) this->rib->slots[this->slot].epoch.store(0);
+}
+
+const BGPRibEntry* BGPRibSnapshot::lookup(const BGPRoute &route) const {
+    uint32_t prefix = ntohl(route.prefix) & maskOf(route.length);
+    const BGPRibNode *node = this->current->root;
+
+    while (node) {
+        if (node->length > route.length || commonLength(node->prefix, prefix, node->length) < node->length) return NULL;
+        if (node->length == route.length) return node->has_entry ? &node->entry : NULL;
+        node = node->child[bitAt(prefix, node->length)];
+    }
+
+    return NULL;
+}
+
+const BGPRibEntry* BGPRibSnapshot::longestMatch(uint32_t address) const {
+    uint32_t prefix = ntohl(address);
+    const BGPRibNode *node = this->current->root;
+    const BGPRibEntry *found = NULL;
+
+    while (node) {
+        if (commonLength(node->prefix, prefix, node->length) < node->length) break;
+        if (node->has_entry) found = &node->entry;
+        if (node->length == 32) break;
+        node = node->child[bitAt(prefix, node->length)];
+    }
+
+    return found;
+}
+
+static void walkNode(const BGPRibNode *node, const std::function<void (const BGPRibEntry &)> &fn) {
+    if (!node) return;
+    if (node->has_entry) fn(node->entry);
+    walkNode(node->child[0], fn);
+    walkNode(node->child[1], fn);
+}
+
+void BGPRibSnapshot::walk(const std::function<void (const BGPRibEntry &)> &fn) const {
+    walkNode(this->current->root, fn);
+}
+
+size_t BGPRibSnapshot::size() const {
+    return this->current->routes;
+}
+
+uint64_t BGPRibSnapshot::version() const {
+    return this->current->id;
+}
+
+BGPRib::BGPRib() {
+    this->root = NULL;
+    this->routes = 0;
+    this->working = 1;
+    this->epoch = 1;
+    this->nexthops_kept = 0;
+    this->compared_same = false;
+    for (int i = 0; i < MAX_READERS; i++) this->slots[i].epoch = 0;
+
+    auto *version = new BGPRibVersion;
+    version->root = NULL;
+    version->routes = 0;
+    version->id = 0;
+    this->published = version;
+}
+
+static void freeTree(BGPRibNode *node) {
+    if (!node) return;
+    freeTree(node->child[0]);
+    freeTree(node->child[1]);
+    delete node;
+}
+
+BGPRib::~BGPRib() {
+    for (auto &r : this->retired) {
+        for (auto *node : r.nodes) delete node;
+        delete r.version;
+    }
+    for (auto *node : this->pending) delete node;
+    freeTree(this->root);
+    delete this->published.load();
+}
+
+BGPRibNode* BGPRib::make(uint32_t prefix, uint8_t length) {
+    auto *node = new BGPRibNode;
+    node->child[0] = node->child[1] = NULL;
+    node->prefix = prefix & maskOf(length);
+    node->length = length;
+    node->has_entry = false;
+    node->version = this->working;
+    node->entry.route.prefix = htonl(node->prefix);
+    node->entry.route.length = length;
+    node->entry.route.path_id = 0;
+    node->entry.best = -1;
+    return node;
+}
+
+/* writable copy of node for the working version. */
+BGPRibNode* BGPRib::own(BGPRibNode *node) {
+    if (node->version == this->working) return node;
+    auto *copy = new BGPRibNode(*node);
+    copy->version = this->working;
+    this->pending.push_back(node);
+    return copy;
+}
+
+void BGPRib::drop(BGPRibNode *node) {
+    if (node->version == this->working) delete node; // never published
+    else this->pending.push_back(node);
+}
+
+BGPRibNode* BGPRib::insertAt(BGPRibNode *node, uint32_t prefix, uint8_t length, BGPRibNode **target) {
+    if (!node) return *target = this->make(prefix, length);
+
+    uint8_t common = commonLength(node->prefix, prefix, std::min(node->length, length));
+
+    if (common == node->length && common == length) return *target = this->own(node);
+
+    if (common == node->length) {
+        node = this->own(node);
+        int bit = bitAt(prefix, common);
+        node->child[bit] = this->insertAt(node->child[bit], prefix, length, target);
+        return node;
+    }
+
+    // diverges above node: the new prefix or a glue node goes in between.
+    auto *parent = this->make(prefix, common);
+    parent->child[bitAt(node->prefix, common)] = node;
+    if (common == length) return *target = parent;
+
+    auto *leaf = this->make(prefix, length);
+    parent->child[bitAt(prefix, common)] = leaf;
+    *target = leaf;
+    return parent;
+}
+
+BGPRibNode* BGPRib::collapse(BGPRibNode *node) {
+    if (node->has_entry || (node->child[0] && node->child[1])) return node;
+    auto *only = node->child[0] ? node->child[0] : node->child[1];
+    this->drop(node);
+    return only;
+}
+
+/* removes the path (peer, path_id) if its generation is in [from, below).
+ * a dead one was let go of by the peer's accounting in peerDown() already.
+ */
+BGPRibNode* BGPRib::removeAt(BGPRibNode *node, uint32_t prefix, uint8_t length, uint32_t peer, uint32_t path_id, uint32_t from, uint32_t below, bool *changed) {
+    if (!node || node->length > length || commonLength(node->prefix, prefix, node->length) < node->length) return node;
+
+    if (node->length == length) {
+        if (!node->has_entry) return node;
+        auto &paths = node->entry.paths;
+        auto path = std::find_if(paths.begin(), paths.end(), [peer, path_id, from, below](const BGPRibPath &p) {
+            return p.peer == peer && p.path_id == path_id && p.generation >= from && p.generation < below;
+        });
+        if (path == paths.end()) return node;
+
+        size_t at = path - paths.begin();
+        bool live = path->live();
+        this->leave(path->attributes->nexthop.get());
+        node = this->own(node);
+        node->entry.paths.erase(node->entry.paths.begin() + at);
+        *changed = true;
+
+        if (live) {
+            this->peerOf(peer)->paths--;
+            auto *accounting = this->accountingOf(peer);
+            if (accounting) accounting->removeRoute(ROUTE_BYTES);
+        }
+
+        if (node->entry.paths.size()) {
+            select(node->entry);
+            return node;
+        }
+
+        node->has_entry = false;
+        node->entry.best = -1;
+        this->routes--;
+        return this->collapse(node);
+    }
+
+    int bit = bitAt(prefix, node->length);
+    auto *child = this->removeAt(node->child[bit], prefix, length, peer, path_id, from, below, changed);
+    if (child == node->child[bit]) return node;
+
+    node = this->own(node);
+    node->child[bit] = child;
+    return this->collapse(node);
+}
+
+bool BGPRib::insert(uint32_t peer, const BGPRoute &route, const BGPRibAttributesRef &attributes) {
+    std::lock_guard<std::mutex> guard(this->writer);
+    return this->insertLocked(peer, route, attributes, NULL);
+}
+
+/* best_ns: add the time spent in best-path selection there, if set. */
+bool BGPRib::insertLocked(uint32_t peer, const BGPRoute &route, const BGPRibAttributesRef &attributes, uint64_t *best_ns) {
+    if (route.length > 32 || !attributes) return false;
+
+    uint32_t prefix = ntohl(route.prefix) & maskOf(route.length);
+    auto *owner = this->peerOf(peer);
+    if (owner->restarting && this->refresh(peer, owner, prefix, route, attributes)) return true;
+
+    BGPRibNode *node = NULL;
+    this->root = this->insertAt(this->root, prefix, route.length, &node);
+
+    if (!node->has_entry) {
+        node->has_entry = true;
+        this->routes++;
+    }
+
+    uint32_t generation = owner->generation.load(std::memory_order_relaxed);
+    auto *damping = this->dampingOf(peer);
+
+    // a dead path of the peer not swept yet is taken over as a new one,
+    // a stale one announced differently as the same one.
+    auto &paths = node->entry.paths;
+    auto path = std::find_if(paths.begin(), paths.end(), [peer, &route](const BGPRibPath &p) {
+        return p.peer == peer && p.path_id == route.path_id;
+    });
+    if (path != paths.end() && path->generation == generation) {
+        if (damping && !this->unchanged(path->attributes, attributes))
+            path->suppressed = damping->attributeChanged(node->entry.route, damping->now());
+        if (path->attributes->nexthop != attributes->nexthop) {
+            this->leave(path->attributes->nexthop.get());
+            this->join(attributes->nexthop.get(), node->entry.route);
+        }
+        path->attributes = attributes;
+    } else {
+        bool counted = path != paths.end() && path->live();
+        bool suppressed = damping && damping->suppressed(node->entry.route);
+        if (path != paths.end()) {
+            this->leave(path->attributes->nexthop.get());
+            path->generation = generation;
+            path->attributes = attributes;
+            path->suppressed = suppressed;
+        } else {
+            BGPRibPath p;
+            p.peer = peer;
+            p.path_id = route.path_id;
+            p.generation = generation;
+            p.owner = owner;
+            p.attributes = attributes;
+            p.suppressed = suppressed;
+            paths.push_back(p);
+        }
+        this->join(attributes->nexthop.get(), node->entry.route);
+
+        BGPRoute added = node->entry.route;
+        added.path_id = route.path_id;
+        owner->routes.push_back(added);
+
+        if (!counted) {
+            owner->paths++;
+            auto *accounting = this->accountingOf(peer);
+            if (accounting) accounting->addRoute(ROUTE_BYTES);
+        }
+
+        if (owner->routes.size() > 2 * owner->paths + 16) this->weed(peer, owner);
+    }
+
+    if (owner->restarting) this->dirty.push_back(node->entry.route);
+
+    if (!best_ns) {
+        select(node->entry);
+        return true;
+    }
+
+    uint64_t start = BGPTracer::now();
+    select(node->entry);
+    *best_ns += BGPTracer::now() - start;
+    return true;
+}
+
+bool BGPRib::withdraw(uint32_t peer, const BGPRoute &route) {
+    std::lock_guard<std::mutex> guard(this->writer);
+    return this->withdrawLocked(peer, route);
+}
+
+bool BGPRib::withdrawLocked(uint32_t peer, const BGPRoute &route) {
+    if (route.length > 32) return false;
+
+    auto *owner = this->peerOf(peer);
+    bool changed = false;
+    this->root = this->removeAt(this->root, ntohl(route.prefix) & maskOf(route.length), route.length, peer, route.path_id,
+        owner->floor.load(std::memory_order_relaxed), owner->generation.load(std::memory_order_relaxed) + 1, &changed);
+    if (!changed) return false;
+
+    auto *damping = this->dampingOf(peer);
+    if (damping) {
+        BGPRoute flapped = route;
+        flapped.prefix = htonl(ntohl(route.prefix) & maskOf(route.length));
+        flapped.path_id = 0;
+        damping->withdrawn(flapped, damping->now());
+    }
+
+    if (owner->restarting) {
+        this->dirty.push_back(route);
+        this->dirty.back().path_id = 0;
+    }
+
+    if (owner->routes.size() > 2 * owner->paths + 16) this->weed(peer, owner);
+    return true;
+}
+
+BGPRibPeer* BGPRib::peerOf(uint32_t peer) {
+    auto &state = this->peers[peer];
+    if (!state) {
+        state.reset(new BGPRibPeer);
+        state->generation = 0;
+        state->floor = 0;
+        state->paths = 0;
+        state->restarting = false;
+    }
+    return state.get();
+}
+
+// drop the prefixes the peer has no live path for from its list.
+void BGPRib::weed(uint32_t peer, BGPRibPeer *state) {
+    auto &routes = state->routes;
+    std::sort(routes.begin(), routes.end(), [](const BGPRoute &a, const BGPRoute &b) {
+        if (a.prefix != b.prefix) return a.prefix < b.prefix;
+        return a.length != b.length ? a.length < b.length : a.path_id < b.path_id;
+    });
+
+    size_t kept = 0;
+    for (size_t i = 0; i < routes.size(); i++) {
+        auto &route = routes[i];
+        auto &last = routes[kept ? kept - 1 : 0];
+        if (kept && last.prefix == route.prefix && last.length == route.length && last.path_id == route.path_id) continue;
+
+        auto *node = this->find(ntohl(route.prefix), route.length);
+        if (!node) continue;
+
+        auto &paths = node->entry.paths;
+        if (std::none_of(paths.begin(), paths.end(), [peer, &route](const BGPRibPath &p) {
+            return p.peer == peer && p.path_id == route.path_id && p.live();
+        })) continue;
+
+        routes[kept++] = route;
+    }
+
+    routes.resize(kept);
+}
+
+void BGPRib::peerDown(uint32_t peer) {
+    std::lock_guard<std::mutex> guard(this->writer);
+
+    auto *owner = this->peerOf(peer);
+    auto *accounting = this->accountingOf(peer);
+    if (accounting) accounting->removeRoutes(owner->paths, owner->paths * ROUTE_BYTES);
+
+    Dead d;
+    d.peer = peer;
+    d.below = owner->generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    owner->floor.store(d.below, std::memory_order_relaxed);
+    d.routes.swap(owner->routes);
+    d.next = 0;
+    owner->paths = 0;
+
+    // went down for good before its End-of-RIB: the stale paths go with the rest.
+    if (owner->restarting) {
+        d.routes.insert(d.routes.end(), owner->stale.begin(), owner->stale.end());
+        std::vector<BGPRoute>().swap(owner->stale);
+        owner->restarting = false;
+    }
+
+    if (d.routes.size()) this->dead.push_back(std::move(d));
+}
+
+size_t BGPRib::sweep(size_t batch) {
+    std::lock_guard<std::mutex> guard(this->writer);
+
+    size_t done = 0;
+    while (batch && done < this->dead.size()) {
+        auto &d = this->dead[done];
+        for (; batch && d.next < d.routes.size(); batch--) {
+            auto &route = d.routes[d.next++];
+            bool changed = false;
+            this->root = this->removeAt(this->root, ntohl(route.prefix), route.length, d.peer, route.path_id, 0, d.below, &changed);
+            if (!changed) continue;
+            this->dirty.push_back(route);
+            this->dirty.back().path_id = 0;
+        }
+        if (d.next == d.routes.size()) done++;
+    }
+
+    this->dead.erase(this->dead.begin(), this->dead.begin() + done);
+
+    size_t left = 0;
+    for (auto &d : this->dead) left += d.routes.size() - d.next;
+    return left;
+}
+
+void BGPRib::peerRestarting(uint32_t peer) {
+    std::lock_guard<std::mutex> guard(this->writer);
+
+    auto *owner = this->peerOf(peer);
+    owner->generation.fetch_add(1, std::memory_order_relaxed);
+
+    // restarted again before its End-of-RIB: what it announced since is stale too.
+    if (owner->restarting) owner->stale.insert(owner->stale.end(), owner->routes.begin(), owner->routes.end());
+    else owner->stale.swap(owner->routes);
+    owner->routes.clear();
+    owner->restarting = true;
+}
+
+/* a stale path announced again with the same attributes: unmark it where
+ * it is. false if there is more to it than that.
+ */
+bool BGPRib::refresh(uint32_t peer, BGPRibPeer *owner, uint32_t prefix, const BGPRoute &route, const BGPRibAttributesRef &attributes) {
+    auto *node = this->find(prefix, route.length);
+    if (!node) return false;
+
+    auto &paths = node->entry.paths;
+    auto path = std::find_if(paths.begin(), paths.end(), [peer, &route](const BGPRibPath &p) {
+        return p.peer == peer && p.path_id == route.path_id;
+    });
+    if (path == paths.end() || !path->stale()) return false;
+
+    if (!this->unchanged(path->attributes, attributes)) return false;
+
+    __atomic_store_n(&path->generation, owner->generation.load(std::memory_order_relaxed), __ATOMIC_RELAXED);
+
+    BGPRoute added = node->entry.route;
+    added.path_id = route.path_id;
+    owner->routes.push_back(added);
+    return true;
+}
+
+bool BGPRib::unchanged(const BGPRibAttributesRef &before, const BGPRibAttributesRef &after) {
+    if (before != this->compared_stale || after != this->compared_fresh) {
+        this->compared_stale = before;
+        this->compared_fresh = after;
+        this->compared_same = sameAttributes(*before, *after);
+    }
+    return this->compared_same;
+}
+
+size_t BGPRib::endOfRib(uint32_t peer) {
+    std::lock_guard<std::mutex> guard(this->writer);
+    return this->endOfRibLocked(peer);
+}
+
+size_t BGPRib::endOfRibLocked(uint32_t peer) {
+
+    auto *owner = this->peerOf(peer);
+    if (!owner->restarting) return 0;
+
+    uint32_t floor = owner->floor.load(std::memory_order_relaxed);
+    uint32_t generation = owner->generation.load(std::memory_order_relaxed);
+
+    size_t removed = 0;
+    for (auto &route : owner->stale) {
+        bool changed = false;
+        this->root = this->removeAt(this->root, ntohl(route.prefix), route.length, peer, route.path_id, floor, generation, &changed);
+        if (!changed) continue;
+        removed++;
+        this->dirty.push_back(route);
+        this->dirty.back().path_id = 0;
+    }
+
+    std::vector<BGPRoute>().swap(owner->stale);
+    owner->restarting = false;
+    this->compared_stale.reset();
+    this->compared_fresh.reset();
+    if (owner->routes.size() > 2 * owner->paths + 16) this->weed(peer, owner);
+
+    return removed;
+}
+
+void BGPRib::takeDirty(std::vector<BGPRoute> &routes) {
+    std::lock_guard<std::mutex> guard(this->writer);
+    routes.clear();
+    routes.swap(this->dirty);
+}
+
+bool BGPRib::update(uint32_t peer, const BGPUpdateMessage &msg) {
+    if (msg.error_action == BGP_UPDATE_SESSION_RESET) return false;
+
+    BGPTrace trace = msg.trace;
+    std::lock_guard<std::mutex> guard(this->writer);
+
+    if (msg.end_of_rib) {
+        this->endOfRibLocked(peer);
+        return true;
+    }
+
+    for (auto &route : msg.withdrawn_routes) this->withdrawLocked(peer, route);
+    if (!msg.nlri.size() && !msg.nlri_split.size()) {
+        trace.stage(BGP_TRACE_RIB);
+        return true;
+    }
+
+    // one set for nlri and one for each group a route-map split off.
+    BGPPeerAccounting *accounting = this->accountingOf(peer);
+    std::vector<BGPRibAttributes *> built;
+    auto build = [this, accounting, &trace, &built](const std::vector<BGPPathAttribute> &path_attribute) -> BGPRibAttributesRef {
+        auto *attrs = new BGPRibAttributes(path_attribute);
+        attrs->nexthop = this->nextHopLocked(attrs->next_hop);
+        attrs->trace = trace;
+        if (trace.sampled()) built.push_back(attrs);
+        if (!accounting) return BGPRibAttributesRef(attrs);
+
+        // charged until the last path holding the set lets go of it.
+        size_t bytes = footprint(*attrs);
+        accounting->addAttributes(bytes);
+        return BGPRibAttributesRef(attrs, [accounting, bytes](const BGPRibAttributes *a) {
+            accounting->removeAttributes(bytes);
+            delete a;
+        });
+    };
+
+    uint64_t best_ns = 0;
+    uint64_t *timed = trace.sampled() ? &best_ns : NULL;
+    if (msg.nlri.size()) {
+        auto attributes = build(msg.path_attribute);
+        for (auto &route : msg.nlri) this->insertLocked(peer, route, attributes, timed);
+    }
+    for (auto &split : msg.nlri_split) {
+        auto attributes = build(split.path_attribute);
+        for (auto &route : split.nlri) this->insertLocked(peer, route, attributes, timed);
+    }
+
+    if (trace.sampled()) {
+        uint64_t now = BGPTracer::now();
+        trace.add(BGP_TRACE_RIB, now - trace.last - best_ns);
+        trace.add(BGP_TRACE_BEST_PATH, best_ns);
+        // the sets are only reachable from nodes not published yet, and
+        // commit() waits for the lock: no one else sees them change.
+        for (auto *attrs : built) attrs->trace.last = now;
+    }
+
+    return true;
+}
+
+void BGPRib::setAccounting(uint32_t peer, BGPPeerAccounting *accounting) {
+    std::lock_guard<std::mutex> guard(this->writer);
+    if (accounting) this->accounting[peer] = accounting;
+    else this->accounting.erase(peer);
+}
+
+void BGPRib::setDamping(uint32_t peer, BGPDamping *damping) {
+    std::lock_guard<std::mutex> guard(this->writer);
+    if (damping) this->damping[peer] = damping;
+    else this->damping.erase(peer);
+}
+
+BGPDamping* BGPRib::dampingOf(uint32_t peer) const {
+    if (this->damping.empty()) return NULL;
+    auto found = this->damping.find(peer);
+    return found != this->damping.end() ? found->second : NULL;
+}
+
+void BGPRib::advanceDamping(uint64_t now) {
+    std::lock_guard<std::mutex> guard(this->writer);
+    for (auto &entry : this->damping) {
+        uint32_t peer = entry.first;
+        entry.second->advance(now, [this, peer](const BGPRoute &route) { this->reuseLocked(peer, route); });
+    }
+}
+
+/* as for next-hop changes, the paths are unsuppressed and best re-run in
+ * place, without copying the node.
+ */
+void BGPRib::reuseLocked(uint32_t peer, const BGPRoute &route) {
+    auto *node = this->find(ntohl(route.prefix), route.length);
+    if (!node) return;
+
+    bool reused = false;
+    for (auto &path : node->entry.paths) {
+        if (path.peer != peer || !path.suppressed) continue;
+        __atomic_store_n(&path.suppressed, false, __ATOMIC_RELAXED);
+        reused = true;
+    }
+    if (!reused) return;
+
+    int best = choose(node->entry);
+    if (best == node->entry.best) return;
+    __atomic_store_n(&node->entry.best, best, __ATOMIC_RELAXED);
+    this->dirty.push_back(node->entry.route);
+}
+
+BGPPeerAccounting* BGPRib::accountingOf(uint32_t peer) const {
+    if (this->accounting.empty()) return NULL;
+    auto found = this->accounting.find(peer);
+    return found != this->accounting.end() ? found->second : NULL;
+}
+
+BGPRibNode* BGPRib::find(uint32_t prefix, uint8_t length) const {
+    BGPRibNode *node = this->root;
+
+    while (node) {
+        if (node->length > length || commonLength(node->prefix, prefix, node->length) < node->length) return NULL;
+        if (node->length == length) return node->has_entry ? node : NULL;
+        node = node->child[bitAt(prefix, node->length)];
+    }
+
+    return NULL;
+}
+
+BGPNextHopRef BGPRib::nextHop(uint32_t address) {
+    std::lock_guard<std::mutex> guard(this->writer);
+    return this->nextHopLocked(address);
+}
+
+BGPNextHopRef BGPRib::nextHopLocked(uint32_t address) {
+    auto &nexthop = this->nexthops[address];
+    if (!nexthop) nexthop = std::make_shared<BGPNextHop>(address);
+    return nexthop;
+}
+
+bool BGPRib::setNextHop(uint32_t address, bool reachable, uint32_t metric) {
+    std::lock_guard<std::mutex> guard(this->writer);
+
+    auto nexthop = this->nextHopLocked(address);
+    if (nexthop->reachable() == reachable && nexthop->metric() == metric) return false;
+
+    nexthop->up.store(reachable, std::memory_order_relaxed);
+    nexthop->cost.store(metric, std::memory_order_relaxed);
+
+    if (!nexthop->queued) {
+        nexthop->queued = true;
+        this->changed.push_back(nexthop.get());
+    }
+
+    return true;
+}
+
+void BGPRib::join(BGPNextHop *nexthop, const BGPRoute &route) {
+    if (!nexthop) return;
+    nexthop->paths++;
+    nexthop->routes.push_back(route);
+    if (nexthop->routes.size() > 2 * nexthop->paths + 16) this->regroup(nexthop, false);
+}
+
+void BGPRib::leave(BGPNextHop *nexthop) {
+    if (!nexthop) return;
+    nexthop->paths--;
+    if (nexthop->routes.size() > 2 * nexthop->paths + 16) this->regroup(nexthop, false);
+}
+
+/* drop the prefixes that no longer use the next-hop from its group, and
+ * with reselect, re-run best-path for the rest. only best changes, and the
+ * paths stay as they are, so it is set in place instead of copying the
+ * node; readers already saw the change through getBest().
+ */
+void BGPRib::regroup(BGPNextHop *nexthop, bool reselect) {
+    auto &routes = nexthop->routes;
+    std::sort(routes.begin(), routes.end(), [](const BGPRoute &a, const BGPRoute &b) {
+        return a.prefix != b.prefix ? a.prefix < b.prefix : a.length < b.length;
+    });
+
+    size_t kept = 0;
+    for (size_t i = 0; i < routes.size(); i++) {
+        auto &route = routes[i];
+        if (kept && routes[kept - 1].prefix == route.prefix && routes[kept - 1].length == route.length) continue;
+
+        uint32_t prefix = ntohl(route.prefix);
+        auto *node = this->find(prefix, route.length);
+        if (!node) continue;
+
+        auto &paths = node->entry.paths;
+        if (std::none_of(paths.begin(), paths.end(), [nexthop](const BGPRibPath &p) {
+            return p.attributes->nexthop.get() == nexthop;
+        })) continue;
+
+        routes[kept++] = route;
+        if (!reselect) continue;
+
+        int best = choose(node->entry);
+        if (best == node->entry.best) continue;
+        __atomic_store_n(&node->entry.best, best, __ATOMIC_RELAXED);
+        this->dirty.push_back(node->entry.route);
+    }
+
+    routes.resize(kept);
+}
+
+/* retire tag: readers that pinned an epoch up to and including it may still
+ * see the old nodes. readers pinning after the increment see the new root.
+ */
+void BGPRib::commit() {
+    std::lock_guard<std::mutex> guard(this->writer);
+
+    // next-hops that changed since the last commit, one pass per group.
+    for (auto *nexthop : this->changed) {
+        this->regroup(nexthop, true);
+        nexthop->queued = false;
+    }
+    this->changed.clear();
+
+    // next-hops nothing refers to any more, and in their default state.
+    if (this->nexthops.size() > 2 * this->nexthops_kept + 64) {
+        for (auto it = this->nexthops.begin(); it != this->nexthops.end();) {
+            auto &nexthop = it->second;
+            if (nexthop.use_count() == 1 && nexthop->reachable() && !nexthop->metric()) it = this->nexthops.erase(it);
+            else ++it;
+        }
+        this->nexthops_kept = this->nexthops.size();
+    }
+
+    auto *version = new BGPRibVersion;
+    version->root = this->root;
+    version->routes = this->routes;
+    version->id = this->working;
+
+    Retired r;
+    r.version = this->published.exchange(version);
+    r.nodes.swap(this->pending);
+    r.epoch = this->epoch.fetch_add(1);
+    this->retired.push_back(std::move(r));
+
+    this->working++;
+    this->reclaim();
+}
+
+void BGPRib::reclaim() {
+    uint64_t oldest = this->epoch.load();
+    for (int i = 0; i < MAX_READERS; i++) {
+        uint64_t e = this->slots[i].epoch.load();
+        if (e && e < oldest) oldest = e;
+    }
+
+    size_t done = 0;
+    while (done < this->retired.size() && this->retired[done].epoch < oldest) {
+        for (auto *node : this->retired[done].nodes) delete node;
+        delete this->retired[done].version;
+        done++;
+    }
+
+    this->retired.erase(this->retired.begin(), this->retired.begin() + done);
+}
+
+BGPRibSnapshot BGPRib::snapshot() const {
+    for (;;) {
+        for (int i = 0; i < MAX_READERS; i++) {
+            uint64_t free_slot = 0;
+            if (this->slots[i].epoch.load(std::memory_order_relaxed)) continue;
+            if (!this->slots[i].epoch.compare_exchange_strong(free_slot, this->epoch.load())) continue;
+            return BGPRibSnapshot(this, i, this->published.load());
+        }
+        std::this_thread::yield(); // every slot taken, wait for a reader to leave
+    }
+}
+
+size_t BGPRib::size() const {
+    return this->routes;
+}
+
+int64_t BGPRib::prefixChange(uint32_t peer, const std::vector<BGPRoute> &announced, const std::vector<BGPRoute> &withdrawn) {
+    std::lock_guard<std::mutex> guard(this->writer);
+
+    auto held = [this, peer](const BGPRoute &route) {
+        BGPRibNode *node = this->find(ntohl(route.prefix) & maskOf(route.length), route.length);
+        if (!node) return false;
+        for (auto &path : node->entry.paths)
+            if (path.peer == peer && path.path_id == route.path_id && path.live()) return true;
+        return false;
+    };
+
+    // a route both withdrawn and announced is there after, as in update().
+    std::set<std::pair<uint64_t, uint32_t>> seen;
+    auto key = [](const BGPRoute &route) {
+        return std::make_pair((uint64_t) (ntohl(route.prefix) & maskOf(route.length)) << 8 | route.length, route.path_id);
+    };
+
+    int64_t change = 0;
+    for (auto &route : announced)
+        if (seen.insert(key(route)).second && !held(route)) change++;
+    for (auto &route : withdrawn)
+        if (seen.insert(key(route)).second && held(route)) change--;
+
+    return change;
+}
+
+}
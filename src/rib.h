@@ -0,0 +1,311 @@
+#ifndef LIBBGP_RIB_H
+#define LIBBGP_RIB_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "damping.h"
+#include "inline_vector.h"
+#include "libbgp.h"
+#include "nexthop.h"
+
+namespace LibBGP {
+
+/* attribute set shared by every path that carries it, never modified once
+ * built. the fields best-path needs are pulled out of path_attribute once.
+ */
+typedef struct BGPRibAttributes {
+    std::vector<BGPPathAttribute> path_attribute;
+
+    uint8_t origin;
+    uint32_t next_hop;
+    uint32_t med;
+    uint32_t local_pref;
+    uint32_t as_path_length;
+    BGPAsPath as_path; // AS4_PATH merged in if there is one
+
+    // from the RIB's next-hop table, set by BGPRib::update(). sets built
+    // for insert() should take theirs from BGPRib::nextHop(); without one,
+    // the paths are always taken as reachable.
+    BGPNextHopRef nexthop;
+
+    // of the UPDATE the set came with, if sampled. whatever builds the
+    // outbound UPDATE from a best path hands it to BGPIoBackend::trace(),
+    // which ends BGP_TRACE_ADJ_RIB_OUT.
+    BGPTrace trace;
+
+    BGPRibAttributes(const std::vector<BGPPathAttribute> &path_attribute);
+} BGPRibAttributes;
+
+typedef std::shared_ptr<const BGPRibAttributes> BGPRibAttributesRef;
+
+/* a peer's session as its paths see it. BGPRib::peerDown() bumps the
+ * generation and moves the floor up to it, which kills every path the peer
+ * has in one store. BGPRib::peerRestarting() bumps the generation alone:
+ * the paths from before stay live, but are stale.
+ */
+typedef struct BGPRibPeer {
+    std::atomic<uint32_t> generation;
+    std::atomic<uint32_t> floor; // paths from before it are dead
+
+    // kept under the RIB's writer lock. routes, with their path_id, may
+    // hold ones the peer no longer has a path for, or the same one twice.
+    size_t paths; // live, stale ones included
+    std::vector<BGPRoute> routes;
+    std::vector<BGPRoute> stale; // routes from before the restart
+    bool restarting; // until its End-of-RIB
+} BGPRibPeer;
+
+typedef struct BGPRibPath {
+    uint32_t peer;
+    uint32_t path_id; // ADD-PATH, a peer may have several paths per prefix
+    uint32_t generation; // of the peer when the path was added or last announced
+    const BGPRibPeer *owner;
+    BGPRibAttributesRef attributes;
+    bool suppressed; // by the peer's damping, see BGPRib::setDamping()
+
+    bool live() const; // false once the peer went down, until it is swept
+
+    // live, but from before the peer restarted and not announced again
+    // yet. a path announced again is unmarked in place, for every snapshot.
+    bool stale() const;
+} BGPRibPath;
+
+// most prefixes have one or two paths, they are kept in the node itself.
+typedef BGPInlineVector<BGPRibPath, 2> BGPRibPaths;
+
+typedef struct BGPRibEntry {
+    BGPRoute route; // path_id is 0
+    BGPRibPaths paths; // one per (peer, path_id)
+    int best; // index into paths, -1: none
+
+    /* best as of the last run, unless its next-hop has gone down or its
+     * peer has since; then the best of what is left, chosen again on each
+     * call. best itself is re-run in place for next-hop changes and damping
+     * reuse, see BGPRibSnapshot.
+     */
+    const BGPRibPath* getBest() const;
+} BGPRibEntry;
+
+struct BGPRibNode;
+struct BGPRibVersion;
+class BGPRib;
+
+/* view of the RIB as of one commit, stable in structure only: its
+ * prefixes, their paths and the paths' attribute sets stay as they were at
+ * that commit, but a few fields are written in place, with atomic stores,
+ * and every snapshot that can reach them sees the change at once. those
+ * are best, re-run for a next-hop change (setNextHop()) or a damping reuse
+ * (advanceDamping()); a path's suppressed flag, cleared on reuse; a stale
+ * path's generation, when it is announced again after peerRestarting();
+ * and whether a path is live, which peerDown() changes for all of the
+ * peer's paths with one store. so two reads of the same entry may not agree
+ * on its best path.
+ *
+ * holding it does not block the writer; the memory it sees is only
+ * reclaimed once it is gone, so keep it for a walk, not forever.
+ */
+class BGPRibSnapshot {
+public:
+    BGPRibSnapshot(BGPRibSnapshot &&other);
+    ~BGPRibSnapshot();
+
+    const BGPRibEntry* lookup(const BGPRoute &route) const;
+    const BGPRibEntry* longestMatch(uint32_t address) const; // network byte order
+    void walk(const std::function<void (const BGPRibEntry &)> &fn) const;
+
+    size_t size() const;
+    uint64_t version() const;
+
+private:
+    friend class BGPRib;
+    BGPRibSnapshot(const BGPRib *rib, int slot, const BGPRibVersion *current);
+    BGPRibSnapshot(const BGPRibSnapshot &) = delete;
+    BGPRibSnapshot& operator= (const BGPRibSnapshot &) = delete;
+
+    const BGPRib *rib;
+    int slot;
+    const BGPRibVersion *current;
+};
+
+/* prefix table of paths per peer with best-path selection. the table is a
+ * persistent patricia trie: changes copy the nodes on the way to the prefix
+ * (nodes already copied in the same batch are changed in place) and commit()
+ * publishes the new root with one atomic store. readers pin an epoch and
+ * read the root, and never take the writer's lock; replaced nodes are freed
+ * once no reader is left in an epoch that could reach them.
+ *
+ * insert/withdraw/update/commit may be called from any thread, they are
+ * serialized on the writer lock.
+ */
+class BGPRib {
+public:
+    enum { MAX_READERS = 128 };
+
+    BGPRib();
+    ~BGPRib(); // no snapshot may be alive
+
+    /* changes are only visible to snapshots after commit(). an End-of-RIB
+     * is passed on to endOfRib(), groups in nlri_split get their own
+     * attribute sets. the UPDATE is applied as a whole, under one hold of
+     * the writer lock.
+     *
+     * an UPDATE the parser flagged BGP_UPDATE_SESSION_RESET (a malformed
+     * one, or max-prefix exceeded) is refused as a whole: false, and
+     * nothing changes. the caller sends the NOTIFICATION and drops the
+     * session. treat-as-withdraw ones apply, their nlri are withdrawn.
+     */
+    bool update(uint32_t peer, const BGPUpdateMessage &msg);
+    bool insert(uint32_t peer, const BGPRoute &route, const BGPRibAttributesRef &attributes);
+    bool withdraw(uint32_t peer, const BGPRoute &route);
+    void commit();
+
+    BGPRibSnapshot snapshot() const;
+
+    // keep the peer's Adj-RIB-In prefix count, route and attribute bytes.
+    void setAccounting(uint32_t peer, BGPPeerAccounting *accounting);
+
+    /* RFC 2439 damping of the peer's paths. withdrawals, and announcements
+     * that change a path's attributes, are recorded in damping as flaps, at
+     * the time of its last advance(). a suppressed path stays in the table
+     * but is left out of best-path, and of getBest(), until
+     * advanceDamping() reuses it. one table per peer; NULL to stop.
+     */
+    void setDamping(uint32_t peer, BGPDamping *damping);
+
+    /* advance() the peers' damping tables to now, e.g. once a second. a
+     * reused path is back in best-path from the next commit(), and the
+     * prefixes whose best path it changed are queued for takeDirty().
+     */
+    void advanceDamping(uint64_t now);
+
+    BGPNextHopRef nextHop(uint32_t address); // network byte order
+
+    /* IGP state of a next-hop. readers holding a path see it at once; at
+     * the next commit() best-path is re-run for the prefixes using that
+     * next-hop, and only for those, and the ones whose best changed are
+     * queued for takeDirty(). false if nothing changed.
+     */
+    bool setNextHop(uint32_t address, bool reachable, uint32_t metric);
+
+    /* every path of the peer is dead from here on, at once: best-path and
+     * getBest() pass over them, and the peer's accounting lets go of them.
+     * they stay in the table, and count in size(), until sweep() gets to
+     * them.
+     */
+    void peerDown(uint32_t peer);
+
+    /* Graceful Restart (RFC 4724): the peer's session went down, but it
+     * kept forwarding. its paths stay live and in use, marked stale. one it
+     * announces again with the same attributes is only unmarked, with no
+     * best-path run and no copy of the node.
+     */
+    void peerRestarting(uint32_t peer);
+
+    /* the peer's End-of-RIB, or its restart time running out: removes the
+     * paths still stale, in one pass. the prefixes it took paths from, and
+     * the ones the peer announced differently since peerRestarting(), are
+     * queued for takeDirty(); nothing else changed. returns how many paths
+     * were removed.
+     */
+    size_t endOfRib(uint32_t peer);
+
+    // removes up to batch prefixes' worth of dead paths, for a background
+    // thread to call between commit()s. returns how many prefixes are left.
+    size_t sweep(size_t batch);
+
+    // prefixes sweep() and endOfRib() took paths from, and the ones whose
+    // best path a next-hop change or a damping reuse moved, for the decision
+    // process to look at again. queued until taken.
+    void takeDirty(std::vector<BGPRoute> &routes);
+
+    size_t size() const; // prefixes, including uncommitted changes
+
+    /* how much the peer's prefix count would change by with announced and
+     * withdrawn applied, uncommitted changes included: announced routes it
+     * has a live path for already and repeated ones are not counted. for
+     * max-prefix, see BGPParseContext::rib.
+     */
+    int64_t prefixChange(uint32_t peer, const std::vector<BGPRoute> &announced, const std::vector<BGPRoute> &withdrawn);
+
+private:
+    friend class BGPRibSnapshot;
+    BGPRib(const BGPRib &) = delete;
+    BGPRib& operator= (const BGPRib &) = delete;
+
+    typedef struct Slot {
+        alignas(64) std::atomic<uint64_t> epoch; // 0: free
+    } Slot;
+
+    typedef struct Retired {
+        uint64_t epoch;
+        std::vector<BGPRibNode *> nodes;
+        BGPRibVersion *version;
+    } Retired;
+
+    BGPRibNode* make(uint32_t prefix, uint8_t length);
+    BGPRibNode* own(BGPRibNode *node);
+    void drop(BGPRibNode *node);
+    BGPRibNode* insertAt(BGPRibNode *node, uint32_t prefix, uint8_t length, BGPRibNode **target);
+    BGPRibNode* removeAt(BGPRibNode *node, uint32_t prefix, uint8_t length, uint32_t peer, uint32_t path_id, uint32_t from, uint32_t below, bool *changed);
+    BGPRibNode* collapse(BGPRibNode *node);
+    void reclaim();
+
+    bool insertLocked(uint32_t peer, const BGPRoute &route, const BGPRibAttributesRef &attributes, uint64_t *best_ns);
+    bool withdrawLocked(uint32_t peer, const BGPRoute &route);
+    size_t endOfRibLocked(uint32_t peer);
+    bool refresh(uint32_t peer, BGPRibPeer *owner, uint32_t prefix, const BGPRoute &route, const BGPRibAttributesRef &attributes);
+    bool unchanged(const BGPRibAttributesRef &before, const BGPRibAttributesRef &after);
+    static void select(BGPRibEntry &entry);
+    BGPPeerAccounting* accountingOf(uint32_t peer) const;
+    BGPDamping* dampingOf(uint32_t peer) const;
+    void reuseLocked(uint32_t peer, const BGPRoute &route);
+
+    BGPRibNode* find(uint32_t prefix, uint8_t length) const; // in the working version
+    BGPNextHopRef nextHopLocked(uint32_t address);
+    void join(BGPNextHop *nexthop, const BGPRoute &route);
+    void leave(BGPNextHop *nexthop);
+    void regroup(BGPNextHop *nexthop, bool reselect);
+    BGPRibPeer* peerOf(uint32_t peer);
+    void weed(uint32_t peer, BGPRibPeer *state);
+
+    std::mutex writer;
+    BGPRibNode *root; // working version
+    size_t routes;
+    uint64_t working;
+    std::vector<BGPRibNode *> pending; // replaced in the working version
+    std::vector<Retired> retired;
+    std::unordered_map<uint32_t, BGPPeerAccounting *> accounting;
+    std::unordered_map<uint32_t, BGPDamping *> damping;
+    std::unordered_map<uint32_t, BGPNextHopRef> nexthops;
+    std::vector<BGPNextHop *> changed; // next-hops to re-run at commit
+    size_t nexthops_kept; // after the last sweep of unused next-hops
+
+    typedef struct Dead {
+        uint32_t peer;
+        uint32_t below; // the peer's floor when it went down
+        std::vector<BGPRoute> routes;
+        size_t next; // routes before it are swept
+    } Dead;
+
+    std::unordered_map<uint32_t, std::unique_ptr<BGPRibPeer>> peers;
+    std::vector<Dead> dead; // oldest first
+    std::vector<BGPRoute> dirty;
+
+    // last pair of attribute sets unchanged() compared: paths of one
+    // UPDATE mostly share theirs, so this is one comparison per UPDATE.
+    BGPRibAttributesRef compared_stale, compared_fresh;
+    bool compared_same;
+
+    std::atomic<BGPRibVersion *> published;
+    mutable std::atomic<uint64_t> epoch;
+    mutable Slot slots[MAX_READERS];
+};
+
+}
+
+#endif // LIBBGP_RIB_H
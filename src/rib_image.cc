@@ -0,0 +1,377 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "rib_image.h"
+
+namespace LibBGP {
+
+BGPRibImage::BGPRibImage() {
+    this->map = NULL;
+    this->map_size = 0;
+    this->header = NULL;
+}
+
+BGPRibImage::~BGPRibImage() {
+    this->close();
+}
+
+template <typename T> static bool writeArray(FILE *f, const std::vector<T> &array) {
+    return !array.size() || fwrite(array.data(), sizeof(T), array.size(), f) == array.size();
+}
+
+// sections start 8-byte aligned, so that their records can be read in place.
+static uint64_t aligned(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t) 7;
+}
+
+static bool padTo(FILE *f, uint64_t offset) {
+    static const char zero[8] = { 0 };
+    long at = ftell(f);
+    return at >= 0 && (uint64_t) at <= offset && fwrite(zero, 1, offset - at, f) == offset - at;
+}
+
+/* path attributes as in an UPDATE. AS_PATH and AGGREGATOR are kept with
+ * 4-byte ASNs, whatever the session they came over spoke.
+ */
+static std::string encodeSet(const std::vector<BGPPathAttribute> &path_attribute) {
+    std::string set;
+
+    for (auto &attr : path_attribute) {
+        BGPPathAttribute wide;
+        const BGPPathAttribute *out = &attr;
+        if ((attr.type == 2 || attr.type == 7) && !attr.peer_as4_ok) {
+            wide = attr;
+            wide.peer_as4_ok = true;
+            if (attr.type == 7) wide.aggregator_asn4 = attr.aggregator_asn;
+            out = &wide;
+        }
+
+        size_t at = set.size();
+        set.resize(at + Builders::sizeOfPathAttribute(*out));
+        Builders::buildPathAttribute((uint8_t *) &set[at], *out);
+    }
+
+    return set;
+}
+
+static bool decodeSet(const uint8_t *data, size_t length, std::vector<BGPPathAttribute> &path_attribute) {
+    const uint8_t *end = data + length;
+
+    while (data < end) {
+        if (end - data < 3) return false;
+
+        BGPPathAttribute attr;
+        uint8_t flags = data[0];
+        attr.optional = flags >> 7 & 0x1;
+        attr.transitive = (flags >> 6) & 0x1;
+        attr.partial = (flags >> 5) & 0x1;
+        attr.extened = (flags >> 4) & 0x1;
+        attr.type = data[1];
+        attr.peer_as4_ok = attr.type == 2 || attr.type == 7;
+
+        if (attr.extened) {
+            if (end - data < 4) return false;
+            attr.length = data[2] << 8 | data[3];
+            data += 4;
+        } else {
+            attr.length = data[2];
+            data += 3;
+        }
+
+        if (end - data < attr.length) return false;
+        uint8_t subcode = BGPAttributeRegistry::handler(attr.type).decode(attr, data);
+        data += attr.length;
+
+        if (subcode == BGPAttributeHandler::DROP) continue;
+        if (subcode) return false;
+        path_attribute.push_back(std::move(attr));
+    }
+
+    return true;
+}
+
+bool BGPRibImage::write(const BGPRibSnapshot &snapshot, const char *path) {
+    std::vector<BGPRibImageRoute> routes;
+    std::vector<BGPRibImagePath> paths;
+    std::vector<BGPRibImageAttributes> attributes;
+    std::vector<uint32_t> as_paths;
+    std::string encoded;
+
+    // most routes share their attribute set object; equal sets that are not
+    // shared are caught by their encoding.
+    std::unordered_map<const BGPRibAttributes *, uint32_t> by_object;
+    std::unordered_map<std::string, uint32_t> by_set;
+    std::unordered_map<uint64_t, uint32_t> by_as_path; // by interned path id
+
+    routes.reserve(snapshot.size());
+
+    auto attributesIndex = [&](const BGPRibAttributes &attrs) -> uint32_t {
+        auto known = by_object.find(&attrs);
+        if (known != by_object.end()) return known->second;
+
+        std::string set = encodeSet(attrs.path_attribute);
+        auto same = by_set.find(set);
+        if (same != by_set.end()) {
+            by_object[&attrs] = same->second;
+            return same->second;
+        }
+
+        BGPRibImageAttributes record;
+        memset(&record, 0, sizeof(record));
+        record.next_hop = attrs.next_hop;
+        record.med = attrs.med;
+        record.local_pref = attrs.local_pref;
+        record.origin = attrs.origin;
+
+        auto &as_path = attrs.as_path;
+        if (!as_path.empty()) {
+            auto pooled = by_as_path.find(as_path.id());
+            if (pooled == by_as_path.end()) {
+                pooled = by_as_path.insert(std::make_pair(as_path.id(), (uint32_t) as_paths.size())).first;
+                for (auto asn : as_path) as_paths.push_back(asn);
+            }
+            record.as_path_begin = pooled->second;
+            record.as_path_length = as_path.size();
+        }
+
+        record.encoded_begin = encoded.size();
+        record.encoded_length = set.size();
+        encoded += set;
+
+        uint32_t index = attributes.size();
+        attributes.push_back(record);
+        by_set[set] = index;
+        by_object[&attrs] = index;
+        return index;
+    };
+
+    // the walk is in (prefix, length) order already, see BGPRibSnapshot::walk.
+    snapshot.walk([&](const BGPRibEntry &entry) {
+        BGPRibImageRoute route;
+        memset(&route, 0, sizeof(route));
+        route.prefix = ntohl(entry.route.prefix);
+        route.length = entry.route.length;
+        route.path_begin = paths.size();
+        route.best = -1;
+
+        // paths of peers that went down are left behind.
+        auto *best = entry.getBest();
+        for (auto &p : entry.paths) {
+            if (!p.live()) continue;
+            if (&p == best) route.best = route.path_count;
+            BGPRibImagePath path;
+            path.peer = p.peer;
+            path.path_id = p.path_id;
+            path.attributes = attributesIndex(*p.attributes);
+            paths.push_back(path);
+            route.path_count++;
+        }
+
+        if (route.path_count) routes.push_back(route);
+    });
+
+    BGPRibImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "LIBBGPRI", 8);
+    header.format = FORMAT;
+    header.byte_order = 0x01020304;
+    header.version = snapshot.version();
+    header.routes = routes.size();
+    header.routes_offset = aligned(sizeof(header));
+    header.paths = paths.size();
+    header.paths_offset = aligned(header.routes_offset + routes.size() * sizeof(BGPRibImageRoute));
+    header.attributes = attributes.size();
+    header.attributes_offset = aligned(header.paths_offset + paths.size() * sizeof(BGPRibImagePath));
+    header.as_path_words = as_paths.size();
+    header.as_path_offset = aligned(header.attributes_offset + attributes.size() * sizeof(BGPRibImageAttributes));
+    header.encoded_bytes = encoded.size();
+    header.encoded_offset = aligned(header.as_path_offset + as_paths.size() * sizeof(uint32_t));
+    header.file_size = header.encoded_offset + encoded.size();
+
+    std::string tmp = std::string(path) + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (!f) return false;
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+        padTo(f, header.routes_offset) && writeArray(f, routes) &&
+        padTo(f, header.paths_offset) && writeArray(f, paths) &&
+        padTo(f, header.attributes_offset) && writeArray(f, attributes) &&
+        padTo(f, header.as_path_offset) && writeArray(f, as_paths) &&
+        padTo(f, header.encoded_offset) && (!encoded.size() || fwrite(encoded.data(), 1, encoded.size(), f) == encoded.size());
+    ok = fflush(f) == 0 && ok;
+    ok = fsync(fileno(f)) == 0 && ok;
+    ok = fclose(f) == 0 && ok;
+
+    if (!ok || rename(tmp.c_str(), path) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool BGPRibImage::open(const char *path) {
+    this->close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(BGPRibImageHeader)) {
+        ::close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+
+    auto *header = (const BGPRibImageHeader *) map;
+    uint64_t size = st.st_size;
+
+    auto fits = [size](uint64_t offset, uint64_t count, uint64_t record) {
+        return offset <= size && offset == aligned(offset) && count <= (size - offset) / record;
+    };
+
+    bool valid = memcmp(header->magic, "LIBBGPRI", 8) == 0 && header->format == FORMAT &&
+        header->byte_order == 0x01020304 && header->file_size == size &&
+        fits(header->routes_offset, header->routes, sizeof(BGPRibImageRoute)) &&
+        fits(header->paths_offset, header->paths, sizeof(BGPRibImagePath)) &&
+        fits(header->attributes_offset, header->attributes, sizeof(BGPRibImageAttributes)) &&
+        fits(header->as_path_offset, header->as_path_words, sizeof(uint32_t)) &&
+        fits(header->encoded_offset, header->encoded_bytes, 1);
+
+    if (!valid) {
+        munmap(map, size);
+        return false;
+    }
+
+    // lookups binary search the route array, have it read ahead.
+    madvise(map, size, MADV_WILLNEED);
+
+    this->map = map;
+    this->map_size = size;
+    this->header = header;
+    return true;
+}
+
+void BGPRibImage::close() {
+    if (this->map) munmap(this->map, this->map_size);
+    this->map = NULL;
+    this->map_size = 0;
+    this->header = NULL;
+}
+
+size_t BGPRibImage::size() const {
+    return this->header ? this->header->routes : 0;
+}
+
+uint64_t BGPRibImage::version() const {
+    return this->header ? this->header->version : 0;
+}
+
+const BGPRibImageRoute* BGPRibImage::routes() const {
+    if (!this->header) return NULL;
+    return (const BGPRibImageRoute *) ((const uint8_t *) this->map + this->header->routes_offset);
+}
+
+const BGPRibImageRoute* BGPRibImage::find(uint32_t prefix, uint8_t length) const {
+    const BGPRibImageRoute *base = this->routes();
+    size_t n = this->size();
+
+    while (n > 0) {
+        size_t half = n / 2;
+        auto &mid = base[half];
+        if (mid.prefix < prefix || (mid.prefix == prefix && mid.length < length)) {
+            base += half + 1;
+            n -= half + 1;
+        } else n = half;
+    }
+
+    if (base == this->routes() + this->size() || base->prefix != prefix || base->length != length) return NULL;
+    return base;
+}
+
+const BGPRibImageRoute* BGPRibImage::lookup(const BGPRoute &route) const {
+    if (!this->header || route.length > 32) return NULL;
+    uint32_t mask = route.length ? ~0U << (32 - route.length) : 0;
+    return this->find(ntohl(route.prefix) & mask, route.length);
+}
+
+const BGPRibImageRoute* BGPRibImage::longestMatch(uint32_t address) const {
+    if (!this->header) return NULL;
+    uint32_t host = ntohl(address);
+
+    for (int length = 32; length >= 0; length--) {
+        uint32_t mask = length ? ~0U << (32 - length) : 0;
+        auto *route = this->find(host & mask, length);
+        if (route) return route;
+    }
+
+    return NULL;
+}
+
+const BGPRibImagePath* BGPRibImage::paths(const BGPRibImageRoute &route) const {
+    auto *base = (const BGPRibImagePath *) ((const uint8_t *) this->map + this->header->paths_offset);
+    return base + route.path_begin;
+}
+
+const BGPRibImageAttributes& BGPRibImage::attributes(const BGPRibImagePath &path) const {
+    auto *base = (const BGPRibImageAttributes *) ((const uint8_t *) this->map + this->header->attributes_offset);
+    return base[path.attributes];
+}
+
+const uint32_t* BGPRibImage::asPath(const BGPRibImageAttributes &attributes) const {
+    auto *base = (const uint32_t *) ((const uint8_t *) this->map + this->header->as_path_offset);
+    return base + attributes.as_path_begin;
+}
+
+const uint8_t* BGPRibImage::encoded(const BGPRibImageAttributes &attributes) const {
+    return (const uint8_t *) this->map + this->header->encoded_offset + attributes.encoded_begin;
+}
+
+bool BGPRibImage::load(BGPRib &rib) const {
+    if (!this->header) return false;
+
+    auto *records = (const BGPRibImageAttributes *) ((const uint8_t *) this->map + this->header->attributes_offset);
+    std::vector<BGPRibAttributesRef> sets;
+    sets.reserve(this->header->attributes);
+
+    for (uint64_t i = 0; i < this->header->attributes; i++) {
+        auto &record = records[i];
+        if (record.encoded_begin + record.encoded_length > this->header->encoded_bytes) return false;
+
+        std::vector<BGPPathAttribute> path_attribute;
+        if (!decodeSet(this->encoded(record), record.encoded_length, path_attribute)) return false;
+
+        auto *attrs = new BGPRibAttributes(path_attribute);
+        attrs->nexthop = rib.nextHop(attrs->next_hop);
+        sets.push_back(BGPRibAttributesRef(attrs));
+    }
+
+    auto *routes = this->routes();
+    for (size_t i = 0; i < this->size(); i++) {
+        BGPRoute route;
+        route.prefix = htonl(routes[i].prefix);
+        route.length = routes[i].length;
+
+        auto *paths = this->paths(routes[i]);
+        for (uint16_t j = 0; j < routes[i].path_count; j++) {
+            route.path_id = paths[j].path_id;
+            rib.insert(paths[j].peer, route, sets[paths[j].attributes]);
+        }
+    }
+
+    rib.commit();
+    return true;
+}
+
+}
@@ -0,0 +1,114 @@
+#ifndef LIBBGP_RIB_IMAGE_H
+#define LIBBGP_RIB_IMAGE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "rib.h"
+
+namespace LibBGP {
+
+/* on-disk RIB snapshot, used in place through mmap. all sections are arrays
+ * of fixed-size records at 8-byte aligned offsets from the start of the
+ * file, zero-padded in between; records
+ * refer to each other by index, so nothing needs fixing up on load. host
+ * byte order, the header says which. open() checks the header and section
+ * bounds but not every record's indexes, so only load images you wrote.
+ *
+ *   header
+ *   routes     BGPRibImageRoute[routes], sorted by (prefix, length)
+ *   paths      BGPRibImagePath[paths], each route's paths are contiguous
+ *   attributes BGPRibImageAttributes[attributes], deduplicated
+ *   as paths   uint32_t[as_path_words], deduplicated AS number runs
+ *   encoded    uint8_t[encoded_bytes], each attribute set's path attributes
+ *              as in an UPDATE, with 4-byte ASNs in AS_PATH
+ *
+ * the attribute records pull out what lookups in place need; the encoded
+ * set is the whole of it, for load().
+ */
+typedef struct BGPRibImageHeader {
+    char magic[8]; // "LIBBGPRI"
+    uint32_t format;
+    uint32_t byte_order; // 0x01020304 as written
+    uint64_t file_size;
+    uint64_t version; // of the snapshot written
+    uint64_t routes, routes_offset;
+    uint64_t paths, paths_offset;
+    uint64_t attributes, attributes_offset;
+    uint64_t as_path_words, as_path_offset;
+    uint64_t encoded_bytes, encoded_offset;
+} BGPRibImageHeader;
+
+typedef struct BGPRibImageRoute {
+    uint32_t prefix; // host byte order
+    uint8_t length;
+    uint8_t reserved[3];
+    uint32_t path_begin;
+    uint16_t path_count;
+    int16_t best; // index in this route's paths, -1: none
+} BGPRibImageRoute;
+
+typedef struct BGPRibImagePath {
+    uint32_t peer;
+    uint32_t path_id;
+    uint32_t attributes;
+} BGPRibImagePath;
+
+typedef struct BGPRibImageAttributes {
+    uint32_t next_hop; // network byte order, as in BGPPathAttribute
+    uint32_t med;
+    uint32_t local_pref;
+    uint8_t origin;
+    uint8_t reserved[3];
+    uint32_t as_path_begin;
+    uint32_t as_path_length;
+    uint64_t encoded_begin;
+    uint32_t encoded_length;
+    uint32_t reserved2;
+} BGPRibImageAttributes;
+
+class BGPRibImage {
+public:
+    enum { FORMAT = 4 };
+
+    BGPRibImage();
+    ~BGPRibImage();
+
+    // dump snapshot to path (through a temporary file and rename).
+    static bool write(const BGPRibSnapshot &snapshot, const char *path);
+
+    bool open(const char *path);
+    void close();
+
+    size_t size() const;
+    uint64_t version() const;
+
+    const BGPRibImageRoute* routes() const;
+    const BGPRibImageRoute* lookup(const BGPRoute &route) const;
+    const BGPRibImageRoute* longestMatch(uint32_t address) const; // network byte order
+
+    const BGPRibImagePath* paths(const BGPRibImageRoute &route) const;
+    const BGPRibImageAttributes& attributes(const BGPRibImagePath &path) const;
+    const uint32_t* asPath(const BGPRibImageAttributes &attributes) const;
+    const uint8_t* encoded(const BGPRibImageAttributes &attributes) const;
+
+    /* puts every path of the image into rib through insert(), as paths of
+     * the peers they came from, and commits. each attribute set is decoded
+     * once and shared by its paths, with its next-hop from rib. false,
+     * with nothing inserted, if a set does not decode.
+     */
+    bool load(BGPRib &rib) const;
+
+private:
+    BGPRibImage(const BGPRibImage &) = delete;
+    BGPRibImage& operator= (const BGPRibImage &) = delete;
+
+    const BGPRibImageRoute* find(uint32_t prefix, uint8_t length) const;
+
+    void *map;
+    size_t map_size;
+    const BGPRibImageHeader *header;
+};
+
+}
+
+#endif // LIBBGP_RIB_IMAGE_H
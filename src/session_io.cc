@@ -0,0 +1,385 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include "session_io.h"
+
+namespace LibBGP {
+
+static inline size_t headerLength(const uint8_t *header) {
+    return (header[16] << 8) | header[17];
+}
+
+BGPFramer::BGPFramer() {
+    this->stopped = false;
+}
+
+int BGPFramer::feed(int conn, const uint8_t *data, size_t length, BGPIoHandler *handler) {
+    int messages = 0;
+    this->stopped = false;
+
+    // finish the message the last read ended in first.
+    if (this->partial.size()) {
+        size_t take = std::min(19 - std::min(this->partial.size(), (size_t) 19), length);
+        this->partial.insert(this->partial.end(), data, data + take);
+        data += take;
+        length -= take;
+        if (this->partial.size() < 19) return 0;
+
+        size_t need = headerLength(this->partial.data());
+        if (need < 19 || need > 4096) return -1;
+
+        take = std::min(need - this->partial.size(), length);
+        this->partial.insert(this->partial.end(), data, data + take);
+        data += take;
+        length -= take;
+        if (this->partial.size() < need) return 0;
+
+        handler->message(conn, this->partial.data(), need);
+        this->partial.clear();
+        messages++;
+        if (this->stopped) return messages;
+    }
+
+    while (length >= 19) {
+        size_t need = headerLength(data);
+        if (need < 19 || need > 4096) return -1;
+        if (length < need) break;
+
+        handler->message(conn, data, need);
+        messages++;
+        if (this->stopped) return messages;
+        data += need;
+        length -= need;
+    }
+
+    this->partial.assign(data, data + length);
+    return messages;
+}
+
+void BGPFramer::stop() {
+    this->stopped = true;
+}
+
+BGPIoConnection::BGPIoConnection(int fd) {
+    this->fd = fd;
+    this->written = 0;
+    this->reserved = 0;
+    this->dirty = false;
+    this->closing = false;
+    this->ops = 0;
+    this->accounting = NULL;
+    this->queued_total = 0;
+    this->written_total = 0;
+}
+
+BGPIoBackend* BGPIoBackend::create(int type, BGPIoHandler *handler) {
+    if (type == URING) {
+        auto *uring = new BGPUringBackend(handler);
+        if (uring->ready()) return uring;
+        delete uring;
+    }
+
+    auto *epoll = new BGPEpollBackend(handler);
+    if (epoll->ready()) return epoll;
+    delete epoll;
+    return NULL;
+}
+
+BGPIoBackend::BGPIoBackend(BGPIoHandler *handler) {
+    this->handler = handler;
+    this->active = 0;
+    this->dispatching = -1;
+    this->syscall_count = 0;
+}
+
+BGPIoBackend::~BGPIoBackend() {
+    for (auto *c : this->slots) {
+        if (!c) continue;
+        if (c->fd >= 0) ::close(c->fd);
+        delete c;
+    }
+}
+
+BGPIoConnection* BGPIoBackend::get(int conn) const {
+    if (conn < 0 || (size_t) conn >= this->slots.size()) return NULL;
+    return this->slots[conn];
+}
+
+int BGPIoBackend::allocate(int fd) {
+    int conn;
+    if (this->free_slots.size()) {
+        conn = this->free_slots.back();
+        this->free_slots.pop_back();
+    } else {
+        if (this->slots.size() >= MAX_CONNECTIONS) return -1;
+        conn = this->slots.size();
+        this->slots.push_back(NULL);
+    }
+
+    this->slots[conn] = new BGPIoConnection(fd);
+    this->active++;
+    return conn;
+}
+
+void BGPIoBackend::release(int conn) {
+    auto *c = this->slots[conn];
+    if (c->accounting) c->accounting->removeOutput(this->queued(conn));
+    delete c;
+    this->slots[conn] = NULL;
+    this->free_slots.push_back(conn);
+    this->active--;
+}
+
+int BGPIoBackend::dispatch(int conn, const uint8_t *data, size_t length) {
+    auto *c = this->get(conn);
+    this->dispatching = conn;
+    int messages = c->framer.feed(conn, data, length, this->handler);
+    if (messages < 0) {
+        this->close(conn, EPROTO);
+        messages = 0;
+    }
+    this->dispatching = -1;
+
+    // closed or removed meanwhile: the caller tears it down once done with
+    // the connection.
+    return messages;
+}
+
+void BGPIoBackend::close(int conn, int error) {
+    auto *c = this->get(conn);
+    if (!c || c->closing) return;
+    c->closing = true;
+    c->framer.stop();
+    this->handler->closed(conn, error);
+    if (this->dispatching != conn) this->teardown(conn);
+}
+
+void BGPIoBackend::remove(int conn) {
+    auto *c = this->get(conn);
+    if (!c || c->closing) return;
+    c->closing = true;
+    c->framer.stop();
+    if (this->dispatching != conn) this->teardown(conn);
+}
+
+bool BGPIoBackend::send(int conn, const uint8_t *data, size_t length) {
+    uint8_t *at = this->reserve(conn, length);
+    if (!at) return false;
+    memcpy(at, data, length);
+    this->commit(conn, length);
+    return true;
+}
+
+uint8_t* BGPIoBackend::reserve(int conn, size_t length) {
+    auto *c = this->get(conn);
+    if (!c || c->closing) return NULL;
+    size_t at = c->out.size();
+    c->out.resize(at + length);
+    c->reserved = length;
+    return c->out.data() + at;
+}
+
+void BGPIoBackend::commit(int conn, size_t length) {
+    auto *c = this->get(conn);
+    if (!c || c->closing) return;
+    length = std::min(length, c->reserved);
+    c->out.resize(c->out.size() - c->reserved + length);
+    c->reserved = 0;
+    c->queued_total += length;
+    if (c->accounting) c->accounting->addOutput(length);
+
+    if (!c->dirty && c->out.size()) {
+        c->dirty = true;
+        this->flush_list.push_back(conn);
+    }
+}
+
+void BGPIoBackend::written(BGPIoConnection *c, size_t bytes) {
+    c->written += bytes;
+    c->written_total += bytes;
+    if (c->accounting) c->accounting->removeOutput(bytes);
+
+    if (!c->traces.size() || c->traces[0].first > c->written_total) return;
+
+    size_t done = 0;
+    while (done < c->traces.size() && c->traces[done].first <= c->written_total)
+        c->traces[done++].second.finish();
+    c->traces.erase(c->traces.begin(), c->traces.begin() + done);
+}
+
+void BGPIoBackend::trace(int conn, const BGPTrace &trace) {
+    auto *c = this->get(conn);
+    if (!c || c->closing || !trace.sampled()) return;
+
+    BGPTrace queued = trace;
+    queued.stage(BGP_TRACE_ADJ_RIB_OUT);
+    c->traces.push_back(std::make_pair(c->queued_total, queued));
+}
+
+void BGPIoBackend::setAccounting(int conn, BGPPeerAccounting *accounting) {
+    auto *c = this->get(conn);
+    if (!c) return;
+    size_t pending = this->queued(conn);
+    if (c->accounting) c->accounting->removeOutput(pending);
+    c->accounting = accounting;
+    if (accounting) accounting->addOutput(pending);
+}
+
+size_t BGPIoBackend::queued(int conn) const {
+    auto *c = this->get(conn);
+    if (!c) return 0;
+    return c->out.size() + c->writing.size() - c->written;
+}
+
+size_t BGPIoBackend::connections() const {
+    return this->active;
+}
+
+uint64_t BGPIoBackend::syscalls() const {
+    return this->syscall_count;
+}
+
+BGPEpollBackend::BGPEpollBackend(BGPIoHandler *handler) : BGPIoBackend(handler), buffer(READ_SIZE) {
+    this->epfd = epoll_create1(EPOLL_CLOEXEC);
+}
+
+BGPEpollBackend::~BGPEpollBackend() {
+    if (this->epfd >= 0) ::close(this->epfd);
+}
+
+bool BGPEpollBackend::ready() const {
+    return this->epfd >= 0;
+}
+
+int BGPEpollBackend::type() const {
+    return EPOLL;
+}
+
+int BGPEpollBackend::add(int fd) {
+    int conn = this->allocate(fd);
+    if (conn < 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.u32 = conn;
+    this->syscall_count += 3;
+    if (epoll_ctl(this->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ::close(fd);
+        this->release(conn);
+        return -1;
+    }
+
+    if (this->watching_out.size() < this->slots.size()) this->watching_out.resize(this->slots.size());
+    this->watching_out[conn] = false;
+    return conn;
+}
+
+void BGPEpollBackend::teardown(int conn) {
+    auto *c = this->get(conn);
+    epoll_ctl(this->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    ::close(c->fd);
+    this->syscall_count += 2;
+    this->release(conn);
+}
+
+void BGPEpollBackend::watch(int conn, bool writable) {
+    if (this->watching_out[conn] == writable) return;
+    this->watching_out[conn] = writable;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | (writable ? (uint32_t) EPOLLOUT : 0u);
+    ev.data.u32 = conn;
+    epoll_ctl(this->epfd, EPOLL_CTL_MOD, this->get(conn)->fd, &ev);
+    this->syscall_count++;
+}
+
+bool BGPEpollBackend::flush(int conn) {
+    auto *c = this->get(conn);
+
+    for (;;) {
+        if (c->written == c->writing.size()) {
+            c->writing.clear();
+            c->written = 0;
+            if (!c->out.size()) break;
+            c->writing.swap(c->out);
+        }
+
+        ssize_t n = ::send(c->fd, c->writing.data() + c->written, c->writing.size() - c->written, MSG_NOSIGNAL);
+        this->syscall_count++;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                this->watch(conn, true);
+                return true;
+            }
+            this->close(conn, errno);
+            return false;
+        }
+
+        this->written(c, n);
+    }
+
+    this->watch(conn, false);
+    return true;
+}
+
+int BGPEpollBackend::poll(int timeout_ms) {
+    std::vector<int> flushing;
+    flushing.swap(this->flush_list);
+    for (int conn : flushing) {
+        auto *c = this->get(conn);
+        if (!c) continue;
+        c->dirty = false;
+        if (!c->closing && !this->watching_out[conn]) this->flush(conn);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    int n = epoll_wait(this->epfd, events, MAX_EVENTS, timeout_ms);
+    this->syscall_count++;
+    if (n < 0) return errno == EINTR ? 0 : -1;
+
+    int messages = 0;
+    for (int i = 0; i < n; i++) {
+        int conn = events[i].data.u32;
+        auto *c = this->get(conn);
+        if (!c || c->closing) continue;
+
+        if ((events[i].events & EPOLLOUT) && !this->flush(conn)) continue;
+        if (!(events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))) continue;
+
+        // level-triggered: a read that filled the buffer is followed by
+        // another, the rest waits for the next poll().
+        for (;;) {
+            ssize_t got = read(c->fd, this->buffer.data(), READ_SIZE);
+            this->syscall_count++;
+            if (got > 0) {
+                messages += this->dispatch(conn, this->buffer.data(), got);
+                if (c->closing) {
+                    this->teardown(conn);
+                    break;
+                }
+                if (got < READ_SIZE) break;
+                continue;
+            }
+            if (got == 0) this->close(conn, 0);
+            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) this->close(conn, errno);
+            break;
+        }
+    }
+
+    return messages;
+}
+
+}
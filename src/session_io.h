@@ -0,0 +1,194 @@
+#ifndef LIBBGP_SESSION_IO_H
+#define LIBBGP_SESSION_IO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+#include "accounting.h"
+#include "trace.h"
+
+namespace LibBGP {
+
+class BGPIoHandler {
+public:
+    virtual ~BGPIoHandler() {}
+
+    // one whole message, header included. only valid during the call.
+    virtual void message(int conn, const uint8_t *msg, size_t length) = 0;
+
+    // connection gone, error is 0 on EOF. the backend already dropped it.
+    virtual void closed(int conn, int error) = 0;
+};
+
+/* splits a byte stream into BGP messages. messages that sit wholly in the
+ * input are handed to the handler in place; only a message spanning two
+ * reads is copied.
+ */
+class BGPFramer {
+public:
+    BGPFramer();
+
+    // messages handed out, -1 on a bad length in a message header.
+    int feed(int conn, const uint8_t *data, size_t length, BGPIoHandler *handler);
+
+    // make feed() return after the current message.
+    void stop();
+
+private:
+    std::vector<uint8_t> partial;
+    bool stopped;
+};
+
+typedef struct BGPIoConnection {
+    int fd;
+    BGPFramer framer;
+    std::vector<uint8_t> out; // queued by send()
+    std::vector<uint8_t> writing; // being written, stable until done
+    size_t written;
+    size_t reserved;
+    bool dirty; // on the flush list
+    bool closing;
+    int ops; // io_uring requests in flight
+    BGPPeerAccounting *accounting; // output bytes, if set
+    uint64_t queued_total, written_total; // bytes ever queued / written
+    std::vector<std::pair<uint64_t, BGPTrace>> traces; // sampled, by end offset
+
+    BGPIoConnection(int fd);
+} BGPIoConnection;
+
+/* session socket I/O: reads are framed into BGP messages for a handler,
+ * sends are queued and go out in one write per connection when poll()
+ * runs. use it from one thread.
+ */
+class BGPIoBackend {
+public:
+    enum { EPOLL = 0, URING = 1 };
+    enum { MAX_CONNECTIONS = 1024 };
+
+    // URING falls back to EPOLL where io_uring or the bits of it we need
+    // are not available. NULL if neither works.
+    static BGPIoBackend* create(int type, BGPIoHandler *handler);
+    virtual ~BGPIoBackend();
+
+    virtual int type() const = 0;
+
+    // takes ownership of fd. connection id, -1 on error.
+    virtual int add(int fd) = 0;
+
+    // close without a closed() callback.
+    void remove(int conn);
+
+    // queue a message; copies it.
+    bool send(int conn, const uint8_t *data, size_t length);
+
+    // or serialize straight into the queue: at most length bytes at the
+    // returned pointer, then commit() what was used.
+    uint8_t* reserve(int conn, size_t length);
+    void commit(int conn, size_t length);
+
+    // the message queued last carries trace: its Adj-RIB-Out stage ends
+    // here, and it finishes once written (see BGPTrace::finish()).
+    void trace(int conn, const BGPTrace &trace);
+
+    // write what was queued, wait up to timeout_ms (-1: forever) and
+    // dispatch. messages dispatched, -1 on error.
+    virtual int poll(int timeout_ms) = 0;
+
+    // count the connection's unwritten output bytes there.
+    void setAccounting(int conn, BGPPeerAccounting *accounting);
+
+    size_t queued(int conn) const; // bytes not yet written
+    size_t connections() const;
+    uint64_t syscalls() const; // made by the backend so far
+
+protected:
+    BGPIoBackend(BGPIoHandler *handler);
+
+    BGPIoConnection* get(int conn) const;
+    int allocate(int fd);
+    void release(int conn);
+    void written(BGPIoConnection *c, size_t bytes);
+    int dispatch(int conn, const uint8_t *data, size_t length);
+    void close(int conn, int error);
+    virtual void teardown(int conn) = 0;
+
+    BGPIoHandler *handler;
+    std::vector<BGPIoConnection *> slots;
+    std::vector<int> free_slots;
+    std::vector<int> flush_list;
+    size_t active;
+    int dispatching;
+    uint64_t syscall_count;
+
+private:
+    BGPIoBackend(const BGPIoBackend &) = delete;
+    BGPIoBackend& operator= (const BGPIoBackend &) = delete;
+};
+
+class BGPEpollBackend : public BGPIoBackend {
+public:
+    enum { READ_SIZE = 64 * 1024, MAX_EVENTS = 64 };
+
+    BGPEpollBackend(BGPIoHandler *handler);
+    ~BGPEpollBackend();
+
+    bool ready() const;
+    int type() const;
+    int add(int fd);
+    int poll(int timeout_ms);
+
+private:
+    void teardown(int conn);
+    bool flush(int conn); // false if the connection was closed
+    void watch(int conn, bool writable);
+
+    int epfd;
+    std::vector<uint8_t> buffer;
+    std::vector<bool> watching_out;
+};
+
+/* io_uring without liburing. each connection is a fixed file with one
+ * multishot recv that picks buffers from a registered buffer ring, so
+ * reads need no syscalls of their own; the framer reads messages straight
+ * out of those buffers. queued sends become one SEND per connection, and
+ * all of them plus the wait for completions are a single io_uring_enter().
+ */
+class BGPUringBackend : public BGPIoBackend {
+public:
+    enum { ENTRIES = 256, CQ_ENTRIES = 4096, BUFFERS = 256, BUFFER_SIZE = 16 * 1024 };
+
+    BGPUringBackend(BGPIoHandler *handler);
+    ~BGPUringBackend();
+
+    bool ready() const;
+    int type() const;
+    int add(int fd);
+    int poll(int timeout_ms);
+
+private:
+    void teardown(int conn);
+    void* sqe();
+    int enter(unsigned int submit, unsigned int wait, int timeout_ms);
+    bool setFile(int conn, int fd);
+    void armRecv(int conn);
+    void armSend(int conn);
+    void recycle(unsigned int buffer);
+    void completed(uint64_t data, int res, unsigned int flags);
+
+    int ring;
+    void *sq_map, *sqe_map, *buf_map; // the CQ ring shares the SQ ring mapping
+    size_t sq_map_size, sqe_map_size, buf_map_size;
+    unsigned int *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned int *cq_head, *cq_tail, *cq_mask;
+    void *cqes;
+    unsigned int sq_entries, sq_pending;
+    unsigned short *buf_tail;
+    unsigned short buf_next;
+    uint8_t *buffers;
+    bool usable;
+    int delivered;
+};
+
+}
+
+#endif // LIBBGP_SESSION_IO_H
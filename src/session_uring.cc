@@ -0,0 +1,352 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include "session_io.h"
+
+namespace LibBGP {
+
+// multishot recv and buffer rings came with Linux 6.0 headers.
+#if defined(IORING_RECV_MULTISHOT) && defined(__NR_io_uring_setup)
+
+enum { OP_RECV = 1, OP_SEND = 2 };
+
+static inline uint64_t userData(int op, int conn) {
+    return ((uint64_t) op << 32) | (uint32_t) conn;
+}
+
+BGPUringBackend::BGPUringBackend(BGPIoHandler *handler) : BGPIoBackend(handler) {
+    this->ring = -1;
+    this->sq_map = this->sqe_map = this->buf_map = NULL;
+    this->sq_map_size = this->sqe_map_size = this->buf_map_size = 0;
+    this->sq_entries = this->sq_pending = 0;
+    this->buf_next = 0;
+    this->buffers = NULL;
+    this->usable = false;
+    this->delivered = 0;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    p.cq_entries = CQ_ENTRIES;
+    this->ring = syscall(__NR_io_uring_setup, ENTRIES, &p);
+    if (this->ring < 0) {
+        // older kernels reject flags they do not know.
+        memset(&p, 0, sizeof(p));
+        p.flags = IORING_SETUP_CQSIZE;
+        p.cq_entries = CQ_ENTRIES;
+        this->ring = syscall(__NR_io_uring_setup, ENTRIES, &p);
+    }
+    if (this->ring < 0) return;
+
+    unsigned int needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+    if ((p.features & needed) != needed) return;
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    this->sq_map_size = sq_size > cq_size ? sq_size : cq_size;
+    this->sq_map = mmap(NULL, this->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_SQ_RING);
+    if (this->sq_map == MAP_FAILED) {
+        this->sq_map = NULL;
+        return;
+    }
+
+    this->sqe_map_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    this->sqe_map = mmap(NULL, this->sqe_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, this->ring, IORING_OFF_SQES);
+    if (this->sqe_map == MAP_FAILED) {
+        this->sqe_map = NULL;
+        return;
+    }
+
+    uint8_t *sq = (uint8_t *) this->sq_map;
+    this->sq_head = (unsigned int *) (sq + p.sq_off.head);
+    this->sq_tail = (unsigned int *) (sq + p.sq_off.tail);
+    this->sq_mask = (unsigned int *) (sq + p.sq_off.ring_mask);
+    this->sq_array = (unsigned int *) (sq + p.sq_off.array);
+    this->cq_head = (unsigned int *) (sq + p.cq_off.head);
+    this->cq_tail = (unsigned int *) (sq + p.cq_off.tail);
+    this->cq_mask = (unsigned int *) (sq + p.cq_off.ring_mask);
+    this->cqes = sq + p.cq_off.cqes;
+    this->sq_entries = p.sq_entries;
+
+    // sparse fixed file table, slot i is connection i.
+    std::vector<int> files(MAX_CONNECTIONS, -1);
+    if (syscall(__NR_io_uring_register, this->ring, IORING_REGISTER_FILES, files.data(), MAX_CONNECTIONS) < 0) return;
+
+    this->buf_map_size = BUFFERS * sizeof(struct io_uring_buf);
+    this->buf_map = mmap(NULL, this->buf_map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (this->buf_map == MAP_FAILED) {
+        this->buf_map = NULL;
+        return;
+    }
+
+    this->buffers = (uint8_t *) mmap(NULL, (size_t) BUFFERS * BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (this->buffers == MAP_FAILED) {
+        this->buffers = NULL;
+        return;
+    }
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t) this->buf_map;
+    reg.ring_entries = BUFFERS;
+    reg.bgid = 0;
+    if (syscall(__NR_io_uring_register, this->ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return;
+
+    // the ring tail shares its place with the first entry's reserved field.
+    this->buf_tail = (unsigned short *) ((uint8_t *) this->buf_map + offsetof(struct io_uring_buf_ring, tail));
+    for (unsigned int i = 0; i < BUFFERS; i++) this->recycle(i);
+    __atomic_store_n(this->buf_tail, this->buf_next, __ATOMIC_RELEASE);
+
+    this->usable = true;
+}
+
+BGPUringBackend::~BGPUringBackend() {
+    // stop the sockets first so nothing in flight still points at buffers.
+    for (auto *c : this->slots)
+        if (c && c->fd >= 0) shutdown(c->fd, SHUT_RDWR);
+
+    if (this->ring >= 0) ::close(this->ring);
+    if (this->sq_map) munmap(this->sq_map, this->sq_map_size);
+    if (this->sqe_map) munmap(this->sqe_map, this->sqe_map_size);
+    if (this->buf_map) munmap(this->buf_map, this->buf_map_size);
+    if (this->buffers) munmap(this->buffers, (size_t) BUFFERS * BUFFER_SIZE);
+}
+
+bool BGPUringBackend::ready() const {
+    return this->usable;
+}
+
+int BGPUringBackend::type() const {
+    return URING;
+}
+
+/* next free submission entry, zeroed and already counted in the tail. the
+ * kernel does not look at the queue until we enter, so filling it in after
+ * is fine.
+ */
+void* BGPUringBackend::sqe() {
+    unsigned int tail = *this->sq_tail;
+    if (tail - __atomic_load_n(this->sq_head, __ATOMIC_ACQUIRE) >= this->sq_entries) {
+        this->enter(this->sq_pending, 0, 0);
+        tail = *this->sq_tail;
+    }
+
+    unsigned int index = tail & *this->sq_mask;
+    auto *e = (struct io_uring_sqe *) this->sqe_map + index;
+    memset(e, 0, sizeof(*e));
+    this->sq_array[index] = index;
+    __atomic_store_n(this->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    this->sq_pending++;
+    return e;
+}
+
+int BGPUringBackend::enter(unsigned int submit, unsigned int wait, int timeout_ms) {
+    unsigned int flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void *argp = NULL;
+    size_t argsz = 0;
+
+    if (wait && timeout_ms >= 0) {
+        memset(&arg, 0, sizeof(arg));
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (timeout_ms % 1000) * 1000000LL;
+        arg.ts = (uint64_t) &ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof(arg);
+    }
+
+    int ret = syscall(__NR_io_uring_enter, this->ring, submit, wait, flags, argp, argsz);
+    this->syscall_count++;
+    if (ret > 0) this->sq_pending -= (unsigned int) ret < this->sq_pending ? ret : this->sq_pending;
+    if (ret < 0 && (errno == ETIME || errno == EINTR || errno == EBUSY)) return 0;
+    return ret;
+}
+
+bool BGPUringBackend::setFile(int conn, int fd) {
+    struct io_uring_files_update update;
+    memset(&update, 0, sizeof(update));
+    update.offset = conn;
+    update.fds = (uint64_t) &fd;
+    this->syscall_count++;
+    return syscall(__NR_io_uring_register, this->ring, IORING_REGISTER_FILES_UPDATE, &update, 1) == 1;
+}
+
+void BGPUringBackend::recycle(unsigned int buffer) {
+    auto *ring = (struct io_uring_buf *) this->buf_map;
+    auto &entry = ring[this->buf_next & (BUFFERS - 1)];
+    entry.addr = (uint64_t) (this->buffers + (size_t) buffer * BUFFER_SIZE);
+    entry.len = BUFFER_SIZE;
+    entry.bid = buffer;
+    this->buf_next++;
+}
+
+void BGPUringBackend::armRecv(int conn) {
+    auto *e = (struct io_uring_sqe *) this->sqe();
+    e->opcode = IORING_OP_RECV;
+    e->fd = conn;
+    e->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+    e->ioprio = IORING_RECV_MULTISHOT;
+    e->buf_group = 0;
+    e->user_data = userData(OP_RECV, conn);
+    this->get(conn)->ops++;
+}
+
+/* one send per connection in flight, so writes stay in order; whatever was
+ * queued meanwhile goes out as one send when it completes.
+ */
+void BGPUringBackend::armSend(int conn) {
+    auto *c = this->get(conn);
+    if (c->written == c->writing.size()) {
+        c->writing.clear();
+        c->written = 0;
+        if (!c->out.size()) return;
+        c->writing.swap(c->out);
+    }
+
+    auto *e = (struct io_uring_sqe *) this->sqe();
+    e->opcode = IORING_OP_SEND;
+    e->fd = conn;
+    e->flags = IOSQE_FIXED_FILE;
+    e->addr = (uint64_t) (c->writing.data() + c->written);
+    e->len = c->writing.size() - c->written;
+    e->msg_flags = MSG_NOSIGNAL;
+    e->user_data = userData(OP_SEND, conn);
+    c->ops++;
+}
+
+int BGPUringBackend::add(int fd) {
+    int conn = this->allocate(fd);
+    if (conn < 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    if (!this->setFile(conn, fd)) {
+        ::close(fd);
+        this->release(conn);
+        return -1;
+    }
+
+    this->armRecv(conn);
+    return conn;
+}
+
+/* requests still in flight hold on to the connection (and its send buffer)
+ * until they complete; shutting the socket down makes them do so.
+ */
+void BGPUringBackend::teardown(int conn) {
+    auto *c = this->get(conn);
+    if (c->fd >= 0) {
+        shutdown(c->fd, SHUT_RDWR);
+        this->setFile(conn, -1);
+        ::close(c->fd);
+        this->syscall_count += 2;
+        c->fd = -1;
+    }
+
+    if (!c->ops) this->release(conn);
+}
+
+void BGPUringBackend::completed(uint64_t data, int res, unsigned int flags) {
+    int op = data >> 32;
+    int conn = (uint32_t) data;
+    auto *c = this->get(conn);
+
+    if (op == OP_RECV) {
+        bool more = flags & IORING_CQE_F_MORE;
+        if (!more) c->ops--;
+
+        if (flags & IORING_CQE_F_BUFFER) {
+            unsigned int buffer = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (res > 0 && !c->closing) this->delivered += this->dispatch(conn, this->buffers + (size_t) buffer * BUFFER_SIZE, res);
+            this->recycle(buffer);
+        }
+
+        if (c->closing) {
+            this->teardown(conn);
+            return;
+        }
+
+        if (more) return;
+        if (res == 0) this->close(conn, 0);
+        else if (res < 0 && res != -ENOBUFS) this->close(conn, -res);
+        else this->armRecv(conn); // ran out of buffers, or the kernel ended it
+        return;
+    }
+
+    c->ops--;
+    if (c->closing) {
+        this->teardown(conn);
+        return;
+    }
+
+    if (res < 0) {
+        this->close(conn, -res);
+        return;
+    }
+
+    this->written(c, res);
+    this->armSend(conn);
+}
+
+int BGPUringBackend::poll(int timeout_ms) {
+    std::vector<int> flushing;
+    flushing.swap(this->flush_list);
+    for (int conn : flushing) {
+        auto *c = this->get(conn);
+        if (!c) continue;
+        c->dirty = false;
+        if (!c->closing && c->written == c->writing.size()) this->armSend(conn);
+    }
+
+    bool waiting = *this->cq_tail == __atomic_load_n(this->cq_head, __ATOMIC_RELAXED) && timeout_ms != 0;
+    if ((this->sq_pending || waiting) && this->enter(this->sq_pending, waiting ? 1 : 0, timeout_ms) < 0) return -1;
+
+    this->delivered = 0;
+    unsigned int head = *this->cq_head;
+    unsigned int tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+    auto *cqes = (struct io_uring_cqe *) this->cqes;
+
+    while (head != tail) {
+        auto &cqe = cqes[head & *this->cq_mask];
+        uint64_t data = cqe.user_data;
+        int res = cqe.res;
+        unsigned int flags = cqe.flags;
+        head++;
+        this->completed(data, res, flags);
+
+        if (head == tail) {
+            __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+            tail = __atomic_load_n(this->cq_tail, __ATOMIC_ACQUIRE);
+        }
+    }
+
+    __atomic_store_n(this->cq_head, head, __ATOMIC_RELEASE);
+    __atomic_store_n(this->buf_tail, this->buf_next, __ATOMIC_RELEASE);
+    return this->delivered;
+}
+
+#else
+
+BGPUringBackend::BGPUringBackend(BGPIoHandler *handler) : BGPIoBackend(handler) {
+    this->usable = false;
+}
+
+BGPUringBackend::~BGPUringBackend() {}
+bool BGPUringBackend::ready() const { return false; }
+int BGPUringBackend::type() const { return URING; }
+int BGPUringBackend::add(int fd) { ::close(fd); return -1; }
+int BGPUringBackend::poll(int) { return -1; }
+void BGPUringBackend::teardown(int conn) { this->release(conn); }
+
+#endif
+
+}
@@ -0,0 +1,104 @@
+#include <stdint.h>
+#include "timer_wheel.h"
+
+namespace LibBGP {
+
+BGPTimer::BGPTimer() {
+    this->prev = this->next = NULL;
+    this->expires = 0;
+}
+
+BGPTimerWheel::BGPTimerWheel(uint64_t now) {
+    this->current = now;
+    this->count = 0;
+    for (int l = 0; l < LEVELS; l++)
+        for (int s = 0; s < SLOTS; s++) this->slots[l][s].prev = this->slots[l][s].next = &this->slots[l][s];
+    this->overflow.prev = this->overflow.next = &this->overflow;
+}
+
+void BGPTimerWheel::link(BGPTimer *head, BGPTimer *timer) {
+    timer->next = head->next;
+    timer->prev = head;
+    head->next->prev = timer;
+    head->next = timer;
+}
+
+/* a timer goes to the lowest level where its expiry and now share all the
+ * higher bits, in the slot given by its own bits at that level. so a slot is
+ * only ever cascaded (or fired) once now has reached its range.
+ */
+void BGPTimerWheel::place(BGPTimer *timer) {
+    for (int l = 0; l < LEVELS; l++) {
+        int shift = SLOT_BITS * (l + 1);
+        if ((timer->expires >> shift) == (this->current >> shift)) {
+            this->link(&this->slots[l][(timer->expires >> (SLOT_BITS * l)) & (SLOTS - 1)], timer);
+            return;
+        }
+    }
+
+    this->link(&this->overflow, timer);
+}
+
+void BGPTimerWheel::schedule(BGPTimer *timer, uint64_t expires) {
+    if (this->scheduled(timer)) this->cancel(timer);
+    timer->expires = expires > this->current ? expires : this->current + 1;
+    this->place(timer);
+    this->count++;
+}
+
+void BGPTimerWheel::cancel(BGPTimer *timer) {
+    if (!this->scheduled(timer)) return;
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = timer->next = NULL;
+    this->count--;
+}
+
+bool BGPTimerWheel::scheduled(const BGPTimer *timer) const {
+    return timer->next != NULL;
+}
+
+void BGPTimerWheel::cascade(BGPTimer *head) {
+    BGPTimer *timer = head->next;
+    head->prev = head->next = head;
+
+    while (timer != head) {
+        BGPTimer *next = timer->next;
+        this->place(timer);
+        timer = next;
+    }
+}
+
+void BGPTimerWheel::advance(uint64_t now, const std::function<void (BGPTimer *)> &fire) {
+    while (this->current < now) {
+        this->current++;
+
+        /* moving into a new block of a level: spread its slot over the lower
+         * ones. highest level first, so what it drops into a lower level
+         * still gets cascaded in this tick.
+         */
+        int top = 0;
+        while (top < LEVELS && !(this->current & ((1ULL << (SLOT_BITS * (top + 1))) - 1))) top++;
+
+        if (top == LEVELS) this->cascade(&this->overflow);
+        for (int l = (top < LEVELS ? top : LEVELS - 1); l >= 1; l--)
+            this->cascade(&this->slots[l][(this->current >> (SLOT_BITS * l)) & (SLOTS - 1)]);
+
+        BGPTimer *head = &this->slots[0][this->current & (SLOTS - 1)];
+        while (head->next != head) {
+            BGPTimer *timer = head->next;
+            this->cancel(timer);
+            fire(timer);
+        }
+    }
+}
+
+uint64_t BGPTimerWheel::now() const {
+    return this->current;
+}
+
+size_t BGPTimerWheel::size() const {
+    return this->count;
+}
+
+}
@@ -0,0 +1,55 @@
+#ifndef LIBBGP_TIMER_WHEEL_H
+#define LIBBGP_TIMER_WHEEL_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <functional>
+
+namespace LibBGP {
+
+/* intrusive timer, embed (or inherit) it in whatever needs to be woken up. */
+typedef struct BGPTimer {
+    BGPTimer *prev;
+    BGPTimer *next;
+    uint64_t expires;
+
+    BGPTimer();
+} BGPTimer;
+
+/* hierarchical timing wheel: 4 levels of 64 slots, so schedule and cancel are
+ * O(1) and advancing only touches due slots (plus one cascade every 64
+ * ticks per level). the unit of a tick is up to the user (seconds for
+ * damping). timers further out than 64^4 ticks wait in an overflow list.
+ */
+class BGPTimerWheel {
+public:
+    enum { LEVELS = 4, SLOT_BITS = 6, SLOTS = 1 << SLOT_BITS };
+
+    BGPTimerWheel(uint64_t now);
+
+    // (re)schedule timer. expires <= now fires on the next tick.
+    void schedule(BGPTimer *timer, uint64_t expires);
+    void cancel(BGPTimer *timer);
+    bool scheduled(const BGPTimer *timer) const;
+
+    // process ticks up to now, calling fire for every due timer. fire may
+    // schedule or cancel timers, including the one it was called for.
+    void advance(uint64_t now, const std::function<void (BGPTimer *)> &fire);
+
+    uint64_t now() const;
+    size_t size() const;
+
+private:
+    void link(BGPTimer *head, BGPTimer *timer);
+    void place(BGPTimer *timer);
+    void cascade(BGPTimer *head);
+
+    uint64_t current;
+    size_t count;
+    BGPTimer slots[LEVELS][SLOTS]; // list heads
+    BGPTimer overflow;
+};
+
+}
+
+#endif // LIBBGP_TIMER_WHEEL_H
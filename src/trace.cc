@@ -0,0 +1,147 @@
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include "trace.h"
+
+namespace LibBGP {
+
+static const std::memory_order relaxed = std::memory_order_relaxed;
+
+static inline unsigned int bucketOf(uint64_t ns) {
+    if (ns < (1 << BGPLatencyHistogram::SUB_BITS)) return ns;
+    unsigned int msb = 63 - __builtin_clzll(ns);
+    unsigned int shift = msb - BGPLatencyHistogram::SUB_BITS;
+    unsigned int sub = (ns >> shift) & ((1 << BGPLatencyHistogram::SUB_BITS) - 1);
+    return ((shift + 1) << BGPLatencyHistogram::SUB_BITS) + sub;
+}
+
+static inline uint64_t bucketTop(unsigned int bucket) {
+    if (bucket < (1 << BGPLatencyHistogram::SUB_BITS)) return bucket;
+    unsigned int shift = (bucket >> BGPLatencyHistogram::SUB_BITS) - 1;
+    uint64_t sub = bucket & ((1 << BGPLatencyHistogram::SUB_BITS) - 1);
+    return (((1 << BGPLatencyHistogram::SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+BGPLatencyHistogram::BGPLatencyHistogram() {
+    this->clear();
+}
+
+void BGPLatencyHistogram::add(uint64_t ns) {
+    this->buckets[bucketOf(ns)].fetch_add(1, relaxed);
+}
+
+void BGPLatencyHistogram::clear() {
+    for (int i = 0; i < BUCKETS; i++) this->buckets[i].store(0, relaxed);
+}
+
+uint64_t BGPLatencyHistogram::count() const {
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; i++) total += this->buckets[i].load(relaxed);
+    return total;
+}
+
+uint64_t BGPLatencyHistogram::percentile(double q) const {
+    uint64_t counts[BUCKETS], total = 0;
+    for (int i = 0; i < BUCKETS; i++) total += counts[i] = this->buckets[i].load(relaxed);
+    if (!total) return 0;
+
+    // rank of the value wanted, 1-based.
+    uint64_t rank = ceil(q * total);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank) return bucketTop(i);
+    }
+
+    return bucketTop(BUCKETS - 1);
+}
+
+bool BGPTrace::sampled() const {
+    return this->received != 0;
+}
+
+void BGPTrace::stage(int stage) {
+    if (!this->received) return;
+    uint64_t now = BGPTracer::now();
+    this->peer->histograms[stage].add(now - this->last);
+    this->last = now;
+}
+
+void BGPTrace::add(int stage, uint64_t ns) {
+    if (!this->received) return;
+    this->peer->histograms[stage].add(ns);
+}
+
+void BGPTrace::finish() {
+    if (!this->received) return;
+    this->stage(BGP_TRACE_SOCKET);
+    this->peer->histograms[BGP_TRACE_TOTAL].add(this->last - this->received);
+}
+
+BGPPeerTrace::BGPPeerTrace(uint32_t every) {
+    this->every = every;
+    this->counter = 0;
+}
+
+/* the counter is only bumped by the peer's own ingestion path, so a plain
+ * load and store will do; no locked instruction on unsampled UPDATEs.
+ */
+BGPTrace BGPPeerTrace::start() {
+    BGPTrace trace;
+    trace.received = 0;
+    trace.last = 0;
+    trace.peer = this;
+
+    uint32_t every = this->every.load(relaxed);
+    if (!every) return trace;
+
+    uint32_t n = this->counter.load(relaxed) + 1;
+    if (n < every) {
+        this->counter.store(n, relaxed);
+        return trace;
+    }
+
+    this->counter.store(0, relaxed);
+    trace.received = trace.last = BGPTracer::now();
+    return trace;
+}
+
+void BGPPeerTrace::setSampling(uint32_t every) {
+    this->every.store(every, relaxed);
+}
+
+const BGPLatencyHistogram& BGPPeerTrace::histogram(int stage) const {
+    return this->histograms[stage];
+}
+
+void BGPPeerTrace::clear() {
+    for (int i = 0; i < BGP_TRACE_STAGES; i++) this->histograms[i].clear();
+}
+
+BGPTracer::BGPTracer(uint32_t every) {
+    this->every = every;
+}
+
+BGPPeerTrace* BGPTracer::peer(uint32_t peer) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    auto &trace = this->peers[peer];
+    if (!trace) trace.reset(new BGPPeerTrace(this->every));
+    return trace.get();
+}
+
+void BGPTracer::setSampling(uint32_t every) {
+    std::lock_guard<std::mutex> guard(this->lock);
+    this->every = every;
+    for (auto &p : this->peers) p.second->setSampling(every);
+}
+
+uint64_t BGPTracer::now() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+}
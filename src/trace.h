@@ -0,0 +1,103 @@
+#ifndef LIBBGP_TRACE_H
+#define LIBBGP_TRACE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace LibBGP {
+
+enum BGPTraceStage {
+    BGP_TRACE_PARSE = 0, // left the framer -> parsed
+    BGP_TRACE_RIB = 1, // parsed -> in the RIB, best-path excluded
+    BGP_TRACE_BEST_PATH = 2,
+    BGP_TRACE_ADJ_RIB_OUT = 3, // in the RIB -> outbound UPDATE queued, see BGPIoBackend::trace()
+    BGP_TRACE_SOCKET = 4, // queued -> written to the socket
+    BGP_TRACE_TOTAL = 5, // left the framer -> written to the socket
+    BGP_TRACE_STAGES = 6
+};
+
+/* log-linear latency histogram in nanoseconds: 8 buckets per power of two,
+ * so values are within 12.5% of what they report. adding is one relaxed
+ * atomic increment.
+ */
+class BGPLatencyHistogram {
+public:
+    enum { SUB_BITS = 3, BUCKETS = 64 << SUB_BITS };
+
+    BGPLatencyHistogram();
+
+    void add(uint64_t ns);
+    void clear();
+
+    uint64_t count() const;
+    uint64_t percentile(double q) const; // q in [0, 1], upper bound of the bucket of the ceil(q * count)th value
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS];
+};
+
+class BGPPeerTrace;
+
+/* stamp carried by a sampled UPDATE from the framer to the socket. an
+ * unsampled one has received == 0 and every call on it is a no-op.
+ */
+typedef struct BGPTrace {
+    uint64_t received; // monotonic ns, when the message left the framer
+    uint64_t last; // end of the last stage recorded
+    BGPPeerTrace *peer; // histograms of the peer the UPDATE came from
+
+    bool sampled() const;
+    void stage(int stage); // stage ended now
+    void add(int stage, uint64_t ns);
+    void finish(); // written to the socket: the socket stage and the total
+} BGPTrace;
+
+/* per-peer histograms and sampling. the peer's ingestion path calls
+ * start() on every UPDATE; all but one in `every` just bump a counter.
+ */
+class BGPPeerTrace {
+public:
+    BGPPeerTrace(uint32_t every);
+
+    BGPTrace start();
+    void setSampling(uint32_t every); // 0: off
+
+    const BGPLatencyHistogram& histogram(int stage) const;
+    void clear();
+
+private:
+    friend struct BGPTrace;
+    BGPPeerTrace(const BGPPeerTrace &) = delete;
+    BGPPeerTrace& operator= (const BGPPeerTrace &) = delete;
+
+    std::atomic<uint32_t> every;
+    std::atomic<uint32_t> counter;
+    BGPLatencyHistogram histograms[BGP_TRACE_STAGES];
+};
+
+/* the peers' traces, created on first use and kept until the tracer goes. */
+class BGPTracer {
+public:
+    BGPTracer(uint32_t every); // sample one UPDATE in every, 0: off
+
+    BGPPeerTrace* peer(uint32_t peer);
+    void setSampling(uint32_t every);
+
+    static uint64_t now(); // monotonic ns
+
+private:
+    BGPTracer(const BGPTracer &) = delete;
+    BGPTracer& operator= (const BGPTracer &) = delete;
+
+    std::mutex lock;
+    uint32_t every;
+    std::unordered_map<uint32_t, std::unique_ptr<BGPPeerTrace>> peers;
+};
+
+}
+
+#endif // LIBBGP_TRACE_H